@@ -0,0 +1,574 @@
+// epm_bench: microbenchmarks for the crypto, codec and vault layers plus
+// end-to-end command timings against synthetic vaults. Results are written as
+// JSON so that runs can be compared.
+//
+// Usage: epm_bench [--sizes 1000,10000,100000] [--filter <substring>]
+//                  [--shards <n>] [--compress <level>]
+//                  [--block-size <KiB>] [--out <file>] [--keep]
+//
+// Vault sizes up to 10M entries are supported; the generator keeps the whole
+// synthetic vault in memory before writing it, so budget ~300 bytes per entry.
+
+#include "codec.h"
+#include "encryption.h"
+#include "epass.h"
+#include "threadpool.h"
+#include "utils.h"
+#include "vault.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define MASTER_PASSWORD "benchmark-master-password"
+#define MIN_SAMPLES 3
+#define MAX_SAMPLES 1000
+#define MIN_SECONDS 0.25
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+  std::string name;
+  size_t samples;
+  double nsPerOp;
+  double bytesPerOp;
+  std::map<std::string, double> extra;
+};
+
+class Bench {
+public:
+  explicit Bench(const std::string &filter) : filter(filter) {}
+
+  bool Enabled(const std::string &name) const {
+    return filter.empty() || name.find(filter) != std::string::npos;
+  }
+
+  // Time fn, which performs opsPerCall operations, until enough samples have
+  // been collected. Reports the median time per operation.
+  Result *Run(const std::string &name, size_t opsPerCall, double bytesPerOp,
+              const std::function<void()> &fn) {
+    if (!Enabled(name)) {
+      return nullptr;
+    }
+
+    fn(); // warm up caches and lazily initialised state
+
+    std::vector<double> samples;
+    auto start = Clock::now();
+    while (samples.size() < MIN_SAMPLES ||
+           (samples.size() < MAX_SAMPLES &&
+            std::chrono::duration<double>(Clock::now() - start).count() <
+                MIN_SECONDS)) {
+      auto t0 = Clock::now();
+      fn();
+      auto t1 = Clock::now();
+      samples.push_back(
+          std::chrono::duration<double, std::nano>(t1 - t0).count() /
+          opsPerCall);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return Record(name, samples[samples.size() / 2], bytesPerOp,
+                  samples.size());
+  }
+
+  Result *Record(const std::string &name, double nsPerOp, double bytesPerOp,
+                 size_t samples = 1) {
+    results.push_back(Result{name, samples, nsPerOp, bytesPerOp, {}});
+    std::cerr << name << ": " << nsPerOp / 1000 << " us/op" << std::endl;
+    return &results.back();
+  }
+
+  std::string Json(const std::vector<size_t> &sizes, size_t shards,
+                   const Compression &compression) const {
+    std::ostringstream out;
+    out.precision(6);
+    out << std::fixed;
+    out << "{\n  \"context\": {\"threads\": "
+        << std::thread::hardware_concurrency() << ", \"codec\": \""
+        << codec::kernelName() << "\", \"cipher\": \""
+        << cipherEngine(fastestCipher())->Name() << "\", \"shards\": " << shards
+        << ", \"compress_level\": " << compression.level
+        << ", \"block_size\": " << compression.blockSize << ", \"sizes\": [";
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      out << (i ? ", " : "") << sizes[i];
+    }
+    out << "]},\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result &r = results[i];
+      out << (i ? "," : "") << "\n    {\"name\": \"" << r.name
+          << "\", \"samples\": " << r.samples
+          << ", \"ns_per_op\": " << r.nsPerOp
+          << ", \"ops_per_sec\": " << 1e9 / r.nsPerOp;
+      if (r.bytesPerOp > 0) {
+        out << ", \"mb_per_sec\": " << r.bytesPerOp * 1e3 / r.nsPerOp;
+      }
+      for (auto &[key, value] : r.extra) {
+        out << ", \"" << key << "\": " << value;
+      }
+      out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+  }
+
+private:
+  std::string filter;
+  std::deque<Result> results;
+};
+
+static std::string syntheticName(size_t i) {
+  return "https://host-" + std::to_string(i) + ".example.com/login";
+}
+
+static std::string syntheticPassword(size_t i) {
+  return "p@ss-" + std::to_string(i * 2654435761u) + "-word";
+}
+
+// Point HOME at dir so that Epass picks up the vault inside it, and write a
+// key for MASTER_PASSWORD. Returns the vault path.
+static fs::path prepareHome(const fs::path &dir, PasswordManager &keygen,
+                            SecureString &secret) {
+  setenv("HOME", dir.c_str(), 1);
+  fs::path path = getPlatformPath();
+  makeDirs(path);
+
+  secret = keygen.GenerateKey(MASTER_PASSWORD);
+  std::ofstream key(path.parent_path() / "epm.key");
+  key << secret;
+  return path;
+}
+
+static void generateVault(const fs::path &path, size_t count, size_t shards,
+                          const Compression &compression, PasswordManager &pm,
+                          ThreadPool &pool) {
+  Vault vault;
+  vault.Open(path);
+
+  const size_t chunk = 65536;
+  SecureStrings plaintexts(chunk);
+  std::vector<std::string> ciphers(chunk);
+  for (size_t base = 0; base < count; base += chunk) {
+    size_t n = std::min(chunk, count - base);
+    for (size_t i = 0; i < n; ++i) {
+      plaintexts[i] = syntheticPassword(base + i);
+    }
+    pool.ParallelFor(n, 1024, [&](size_t begin, size_t end) {
+      pm.encryptMany(&plaintexts[begin], end - begin, &ciphers[begin]);
+    });
+    for (size_t i = 0; i < n; ++i) {
+      vault.Put(PasswordEntry(syntheticName(base + i), ciphers[i]));
+    }
+  }
+  vault.Compact(shards, compression);
+}
+
+// Bytes of the vault file plus any shard files and logs next to it.
+static uintmax_t vaultBytes(const fs::path &path) {
+  uintmax_t bytes = 0;
+  std::string stem = path.stem().string();
+  for (const auto &file : fs::directory_iterator(path.parent_path())) {
+    std::string name = file.path().filename().string();
+    if (file.is_regular_file() && name.compare(0, stem.size(), stem) == 0 &&
+        file.path().extension() != ".key") {
+      bytes += file.file_size();
+    }
+  }
+  return bytes;
+}
+
+static void benchCrypto(Bench &bench, PasswordManager &pm) {
+  std::string plaintext = syntheticPassword(42);
+  std::string cipher = pm.encrypt(plaintext);
+  std::string out;
+
+  bench.Run("crypto/encrypt", 1, plaintext.size(),
+            [&] { out = pm.encrypt(plaintext); });
+  bench.Run("crypto/decrypt", 1, cipher.size(),
+            [&] { out = pm.decrypt(cipher); });
+  size_t seenBytes = 0;
+  bench.Run("crypto/withPlaintext", 1, cipher.size(), [&] {
+    pm.withPlaintext(cipher, [&seenBytes](std::string_view password) {
+      seenBytes += password.size();
+    });
+  });
+
+  const size_t batch = 4096;
+  SecureStrings plaintexts(batch, SecureString(plaintext));
+  std::vector<std::string> ciphers(batch, cipher);
+  std::vector<std::string> sealed(batch);
+  SecureStrings opened(batch);
+  bench.Run("crypto/encryptMany", batch, plaintext.size(), [&] {
+    pm.encryptMany(plaintexts.data(), batch, sealed.data());
+  });
+  bench.Run("crypto/decryptMany", batch, cipher.size(), [&] {
+    pm.decryptMany(ciphers.data(), batch, opened.data());
+  });
+}
+
+// Seal and open with each entry cipher, on a password and on a larger
+// message, to compare the engines fastestCipher chooses between.
+static void benchCiphers(Bench &bench, const SecureString &secret) {
+  for (uint8_t id = 1; cipherEngine(id) != nullptr; ++id) {
+    PasswordManager pm(secret, static_cast<CipherId>(id));
+    std::string name = cipherEngine(id)->Name();
+
+    for (size_t size : {syntheticPassword(42).size(), size_t(4096)}) {
+      std::string plaintext(size, 'x');
+      std::string cipher = pm.encrypt(plaintext);
+      std::string out;
+      std::string suffix = name + "/" + std::to_string(size);
+      bench.Run("crypto/seal/" + suffix, 1, plaintext.size(),
+                [&] { out = pm.encrypt(plaintext); });
+      bench.Run("crypto/open/" + suffix, 1, cipher.size(),
+                [&] { out = pm.decrypt(cipher); });
+    }
+  }
+}
+
+static void benchCodecs(Bench &bench) {
+  std::string binary(256, '\0');
+  for (size_t i = 0; i < binary.size(); ++i) {
+    binary[i] = static_cast<char>(i * 131 + 7);
+  }
+  std::string b64 = PasswordManager::base64Encode(binary);
+  std::string hex = PasswordManager::hexEncode(binary);
+  std::string out;
+
+  bench.Run("codec/base64Encode", 1, binary.size(),
+            [&] { out = PasswordManager::base64Encode(binary); });
+  bench.Run("codec/base64Decode", 1, b64.size(),
+            [&] { out = PasswordManager::base64Decode(b64); });
+  bench.Run("codec/hexEncode", 1, binary.size(),
+            [&] { out = PasswordManager::hexEncode(binary); });
+  bench.Run("codec/hexDecode", 1, hex.size(),
+            [&] { out = PasswordManager::hexDecode(hex); });
+
+  // Raw kernels over reused buffers, small (one secret) and bulk sizes.
+  for (size_t size : {48, 65536}) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) {
+      data[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+    std::vector<char> text(codec::base64EncodedSize(size));
+    std::vector<uint8_t> back(codec::base64DecodedMaxSize(text.size()));
+    size_t written;
+    codec::base64Encode(data.data(), size, text.data());
+    std::string suffix = "/" + std::to_string(size);
+
+    bench.Run("codec/raw/base64Encode" + suffix, 1, size,
+              [&] { codec::base64Encode(data.data(), size, text.data()); });
+    bench.Run("codec/raw/base64Decode" + suffix, 1, text.size(), [&] {
+      codec::base64Decode(text.data(), text.size(), back.data(), &written);
+    });
+
+    std::vector<char> hexText(size * 2);
+    codec::hexEncode(data.data(), size, hexText.data());
+    bench.Run("codec/raw/hexEncode" + suffix, 1, size,
+              [&] { codec::hexEncode(data.data(), size, hexText.data()); });
+    bench.Run("codec/raw/hexDecode" + suffix, 1, hexText.size(), [&] {
+      codec::hexDecode(hexText.data(), hexText.size(), back.data());
+    });
+  }
+}
+
+// Runs fn with std::cout discarded so that command output is not timed
+// against a terminal.
+static void quietly(const std::function<void()> &fn) {
+  std::ostringstream sink;
+  std::streambuf *old = std::cout.rdbuf(sink.rdbuf());
+  fn();
+  std::cout.rdbuf(old);
+}
+
+// The epm binary built next to epm_bench. Startup runs are skipped without it.
+static fs::path epmBinary;
+
+// Run epm with args, feeding it input on stdin and discarding its output, and
+// wait for it to exit. Times the whole process: loading, crypto setup and the
+// command.
+static void runEpm(const std::vector<std::string> &args,
+                   const std::string &input) {
+  int in[2];
+  if (pipe(in) != 0) {
+    throw std::runtime_error("could not create a pipe");
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in[0], STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(in[0]);
+    close(in[1]);
+
+    std::vector<char *> argv{const_cast<char *>(epmBinary.c_str())};
+    for (const std::string &arg : args) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  close(in[0]);
+  if (pid < 0 ||
+      write(in[1], input.data(), input.size()) !=
+          static_cast<ssize_t>(input.size())) {
+    close(in[1]);
+    throw std::runtime_error("could not start " + epmBinary.string());
+  }
+  close(in[1]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+    throw std::runtime_error("could not run " + epmBinary.string());
+  }
+}
+
+static Result *benchStartup(Bench &bench, const std::string &name,
+                            const std::vector<std::string> &args,
+                            const std::string &input = "") {
+  if (epmBinary.empty()) {
+    return nullptr;
+  }
+  return bench.Run("startup/" + name, 1, 0, [&] { runEpm(args, input); });
+}
+
+static void benchVault(Bench &bench, const fs::path &dir, size_t count,
+                       size_t shards, const Compression &compression,
+                       PasswordManager &keygen, ThreadPool &pool,
+                       double kdfNs) {
+  std::string n = "/" + std::to_string(count);
+  SecureString secret;
+  fs::path path = prepareHome(dir, keygen, secret);
+  PasswordManager pm(secret);
+
+  auto t0 = Clock::now();
+  generateVault(path, count, shards, compression, pm, pool);
+  auto t1 = Clock::now();
+  Result *gen = bench.Record(
+      "vault/generate" + n,
+      std::chrono::duration<double, std::nano>(t1 - t0).count() / count, 0);
+  gen->extra["file_bytes"] = vaultBytes(path);
+
+  // Opened once up front so that the runs below work when this one is
+  // filtered out.
+  Vault vault;
+  vault.Open(path);
+  bench.Run("vault/open" + n, 1, 0, [&] { vault.Open(path); });
+
+  // A lookup in a freshly opened vault, as one command does it: this one
+  // inflates a block of a compressed vault, while find-hit reuses blocks.
+  size_t probe = 0;
+  bench.Run("vault/open-find" + n, 1, 0, [&] {
+    Vault fresh;
+    fresh.Open(path);
+    fresh.Find(syntheticName(probe++ % count));
+  });
+  bench.Run("vault/find-hit" + n, 1, 0, [&] {
+    vault.Find(syntheticName(probe++ % count));
+  });
+  bench.Run("vault/find-miss" + n, 1, 0, [&] {
+    vault.Find("https://missing-" + std::to_string(probe++) + ".example.com");
+  });
+
+  size_t seen = 0;
+  bench.Run("vault/foreach" + n, count, 0, [&] {
+    vault.ForEach([&seen](const EntryView &) { ++seen; });
+  });
+
+  // Completion of a prefix shared by ~11 names, and a fuzzy search over all.
+  size_t names = 0;
+  bench.Run("vault/complete" + n, 1, 0, [&] {
+    vault.ForEachName("https://host-" + std::to_string(probe++ % count / 10 + 1),
+                      [&names](std::string_view) { ++names; });
+  });
+  bench.Run("e2e/search" + n, 1, 0, [&] {
+    quietly([&] {
+      Epass epass;
+      epass.SearchEntries("host42login", 20);
+    });
+  });
+
+  // One add per commit, as 'epm add' does. Includes compactions when the log
+  // crosses its threshold.
+  size_t added = 0;
+  bench.Run("vault/commit-add" + n, 1, 0, [&] {
+    vault.Put(PasswordEntry("bench-add-" + std::to_string(added++),
+                            pm.encrypt("secret")));
+    vault.Commit();
+  });
+
+  bench.Run("vault/compact" + n, 1, 0, [&] { vault.Compact(); });
+
+  // End-to-end commands: a fresh Epass per call, unlocked with the master
+  // password. kdf_ns is the part of each call spent in VerifyKey.
+  auto e2e = [&](const std::string &op, const std::function<void(Epass &)> &fn) {
+    Result *r = bench.Run("e2e/" + op + n, 1, 0, [&] {
+      quietly([&] {
+        Epass epass;
+        if (!epass.Unlock(MASTER_PASSWORD)) {
+          throw std::runtime_error("benchmark vault did not unlock");
+        }
+        fn(epass);
+      });
+    });
+    if (r != nullptr) {
+      r->extra["kdf_ns"] = kdfNs;
+      r->extra["ns_per_op_excl_kdf"] = std::max(0.0, r->nsPerOp - kdfNs);
+    }
+  };
+
+  size_t e2eAdded = 0;
+  size_t e2eProbe = 0;
+  size_t e2eDeleted = 0;
+  e2e("add", [&](Epass &epass) {
+    epass.AddEntry("e2e-add-" + std::to_string(e2eAdded++), "secret");
+  });
+  e2e("get", [&](Epass &epass) {
+    epass.PrintRawEntry(syntheticName(e2eProbe++ % count));
+  });
+  e2e("list", [&](Epass &epass) { epass.ListEntries(); });
+  e2e("export", [&](Epass &epass) {
+    std::ofstream out(dir / "export.csv", std::ios::out | std::ios::trunc);
+    epass.ExportEntries(out, RecordFormat::CSV);
+  });
+  e2e("delete", [&](Epass &epass) {
+    epass.DeleteEntry(syntheticName(e2eDeleted++ % count));
+  });
+  // Re-encrypts the whole vault; includes a second KDF run for the new key.
+  e2e("rekey", [&](Epass &epass) { epass.Rekey(MASTER_PASSWORD); });
+
+  // Whole processes, as wrapper scripts run them: complete needs no key,
+  // get unlocks, so its kdf_ns is reported as for e2e runs.
+  benchStartup(bench, "complete" + n, {"complete", "https://host-4"});
+  Result *get = benchStartup(bench, "get" + n,
+                             {"get", syntheticName(count / 2)},
+                             MASTER_PASSWORD "\n");
+  if (get != nullptr) {
+    get->extra["kdf_ns"] = kdfNs;
+    get->extra["ns_per_op_excl_kdf"] = std::max(0.0, get->nsPerOp - kdfNs);
+  }
+}
+
+static std::vector<size_t> parseSizes(const std::string &arg) {
+  std::vector<size_t> sizes;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t n = std::strtoull(item.c_str(), nullptr, 10);
+    if (n > 0) {
+      sizes.push_back(n);
+    }
+  }
+  return sizes;
+}
+
+int main(int argc, char **argv) {
+  std::vector<size_t> sizes = {1000, 10000, 100000};
+  size_t shards = 1;
+  Compression compression;
+  std::string filter;
+  std::string outPath;
+  bool keep = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+      sizes = parseSizes(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      shards = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+      compression.level = std::min(9UL, std::strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+      compression.blockSize =
+          std::max(1UL, std::strtoul(argv[++i], nullptr, 10)) * 1024;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "--keep") == 0) {
+      keep = true;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--sizes 1000,10000,100000] [--filter <substring>]"
+                   " [--shards <n>] [--compress <level>]"
+                   " [--block-size <KiB>] [--out <file>] [--keep]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  Bench bench(filter);
+  ThreadPool pool;
+  PasswordManager keygen;
+
+  SecureString secret = keygen.GenerateKey(MASTER_PASSWORD);
+  PasswordManager pm(secret);
+
+  benchCrypto(bench, pm);
+  benchCiphers(bench, secret);
+
+  fs::path binary = fs::path(argv[0]).parent_path() / "epm";
+  if (fs::exists(binary)) {
+    epmBinary = fs::absolute(binary);
+    benchStartup(bench, "help", {"help"});
+  } else {
+    std::cerr << "No epm binary next to " << argv[0]
+              << "; skipping startup runs." << std::endl;
+  }
+  benchCodecs(bench);
+
+  // The KDF dominates every command that prompts for the master password,
+  // so it is reported on its own and subtracted from the end-to-end numbers.
+  double kdfNs = 0;
+  Result *kdf = bench.Run("kdf/VerifyKey", 1, 0, [&] {
+    pm.VerifyKey(secret, MASTER_PASSWORD);
+  });
+  if (kdf != nullptr) {
+    kdfNs = kdf->nsPerOp;
+  }
+
+  fs::path root = fs::temp_directory_path() /
+                  ("epm-bench-" + std::to_string(getpid()));
+  const char *home = std::getenv("HOME");
+  std::string savedHome = home ? home : "";
+
+  try {
+    for (size_t count : sizes) {
+      benchVault(bench, root / std::to_string(count), count, shards,
+                 compression, keygen, pool, kdfNs);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "benchmark failed: " << e.what() << std::endl;
+    return 1;
+  }
+
+  setenv("HOME", savedHome.c_str(), 1);
+  if (!keep) {
+    fs::remove_all(root);
+  } else {
+    std::cerr << "Vaults kept in " << root << std::endl;
+  }
+
+  std::string json = bench.Json(sizes, shards, compression);
+  if (outPath.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream out(outPath);
+    out << json;
+  }
+  return 0;
+}
@@ -0,0 +1,469 @@
+// epm_check: behaviour checks for the codec kernels, the entry ciphers, shard
+// validation and sync. Every failed check is printed, and the exit status is
+// non-zero if any failed.
+//
+// Usage: epm_check [codec] [crypto] [shard] [sync]
+//
+// Without arguments every group runs. The codec kernel is picked once per
+// process, so run the codec group once per EPM_CODEC value to cover each
+// kernel; CTest and `make check` do.
+
+#include "cipher.h"
+#include "codec.h"
+#include "encryption.h"
+#include "sync.h"
+#include "utils.h"
+#include "vault.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <openssl/evp.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define SECRET                                                                 \
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define OTHER_SECRET                                                           \
+  "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210"
+
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void check(bool ok, const char *what, const char *file, int line) {
+  if (!ok) {
+    std::cerr << file << ":" << line << ": check failed: " << what
+              << std::endl;
+    ++failures;
+  }
+}
+
+// True if fn throws std::runtime_error.
+static bool throws(const std::function<void()> &fn) {
+  try {
+    fn();
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+static bool same(const SecureString &a, const std::string &b) {
+  return std::string_view(a) == b;
+}
+
+// Bytes that are the same on every run.
+static std::string testBytes(size_t size, uint32_t seed) {
+  std::string bytes(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    seed = seed * 1103515245 + 12345;
+    bytes[i] = static_cast<char>(seed >> 16);
+  }
+  return bytes;
+}
+
+// Plain base64 and hex, one byte at a time, to hold the kernels against.
+static std::string referenceBase64(const std::string &in) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < in.size(); i += 3) {
+    uint32_t group = static_cast<uint8_t>(in[i]) << 16;
+    if (i + 1 < in.size()) {
+      group |= static_cast<uint8_t>(in[i + 1]) << 8;
+    }
+    if (i + 2 < in.size()) {
+      group |= static_cast<uint8_t>(in[i + 2]);
+    }
+    out += alphabet[group >> 18];
+    out += alphabet[(group >> 12) & 63];
+    out += i + 1 < in.size() ? alphabet[(group >> 6) & 63] : '=';
+    out += i + 2 < in.size() ? alphabet[group & 63] : '=';
+  }
+  return out;
+}
+
+static std::string referenceHex(const std::string &in, bool upper) {
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  std::string out;
+  for (char c : in) {
+    out += digits[static_cast<uint8_t>(c) >> 4];
+    out += digits[static_cast<uint8_t>(c) & 15];
+  }
+  return out;
+}
+
+static void checkCodec() {
+  std::cout << "codec: " << codec::kernelName() << std::endl;
+
+  // Every tail length around the kernels' 12/16/24/32-byte steps, and a bulk
+  // size.
+  std::vector<size_t> sizes;
+  for (size_t size = 0; size <= 200; ++size) {
+    sizes.push_back(size);
+  }
+  sizes.push_back(65536 + 7);
+
+  for (size_t size : sizes) {
+    std::string in = testBytes(size, size + 1);
+    auto *bytes = reinterpret_cast<const uint8_t *>(in.data());
+
+    std::string b64(codec::base64EncodedSize(size), '\0');
+    CHECK(codec::base64Encode(bytes, size, &b64[0]) == b64.size());
+    CHECK(b64 == referenceBase64(in));
+
+    std::vector<uint8_t> out(codec::base64DecodedMaxSize(b64.size()) + 1);
+    size_t written = 0;
+    CHECK(codec::base64Decode(b64.data(), b64.size(), out.data(), &written));
+    CHECK(written == size && memcmp(out.data(), in.data(), size) == 0);
+
+    for (bool upper : {false, true}) {
+      std::string hex(2 * size, '\0');
+      codec::hexEncode(bytes, size, &hex[0], upper);
+      CHECK(hex == referenceHex(in, upper));
+      std::vector<uint8_t> decoded(size + 1);
+      CHECK(codec::hexDecode(hex.data(), hex.size(), decoded.data()));
+      CHECK(memcmp(decoded.data(), in.data(), size) == 0);
+    }
+  }
+
+  // Whitespace is skipped; anything else outside the alphabet is rejected,
+  // wherever in a long input it sits.
+  std::string in = testBytes(300, 7);
+  std::string b64 = referenceBase64(in);
+  std::string spaced;
+  for (size_t i = 0; i < b64.size(); ++i) {
+    spaced += b64[i];
+    if (i % 19 == 0) {
+      spaced += i % 2 ? "\r\n" : " \t";
+    }
+  }
+  std::vector<uint8_t> out(codec::base64DecodedMaxSize(spaced.size()));
+  size_t written = 0;
+  CHECK(codec::base64Decode(spaced.data(), spaced.size(), out.data(),
+                            &written));
+  CHECK(written == in.size() && memcmp(out.data(), in.data(), written) == 0);
+  for (size_t at : {size_t(0), size_t(37), size_t(200), b64.size() - 5}) {
+    std::string bad = b64;
+    bad[at] = '*';
+    CHECK(!codec::base64Decode(bad.data(), bad.size(), out.data(), &written));
+  }
+
+  std::string hex = referenceHex(in, false);
+  std::vector<uint8_t> bytes(in.size());
+  CHECK(!codec::hexDecode(hex.data(), hex.size() - 1, bytes.data()));
+  for (size_t at : {size_t(0), size_t(33), hex.size() - 1}) {
+    std::string bad = hex;
+    bad[at] = 'g';
+    CHECK(!codec::hexDecode(bad.data(), bad.size(), bytes.data()));
+  }
+}
+
+// What the releases before sealed entries wrote: AES-128-ECB under the first
+// 16 bytes of the secret.
+static std::string legacyEncrypt(const std::string &secret,
+                                 const std::string &plaintext) {
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  std::string out(plaintext.size() + 16, '\0');
+  int len = 0;
+  int final = 0;
+  EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL,
+                     reinterpret_cast<const unsigned char *>(secret.data()),
+                     NULL);
+  EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char *>(&out[0]), &len,
+                    reinterpret_cast<const unsigned char *>(plaintext.data()),
+                    plaintext.size());
+  EVP_EncryptFinal_ex(ctx, reinterpret_cast<unsigned char *>(&out[len]),
+                      &final);
+  EVP_CIPHER_CTX_free(ctx);
+  out.resize(len + final);
+  return out;
+}
+
+// A legacy ciphertext whose first bytes happen to look like a sealed header.
+static std::string legacyLookingSealed(const std::string &secret,
+                                       std::string &plaintext) {
+  for (uint64_t n = 0;; ++n) {
+    plaintext = "legacy-" + std::to_string(n);
+    std::string cipher = legacyEncrypt(secret, plaintext);
+    if (!PasswordManager::IsLegacy(cipher)) {
+      return cipher;
+    }
+  }
+}
+
+static void checkCrypto() {
+  std::string secret = SECRET;
+  PasswordManager other(OTHER_SECRET);
+
+  for (uint8_t id = 1; cipherEngine(id) != nullptr; ++id) {
+    PasswordManager pm(secret, static_cast<CipherId>(id));
+    std::cout << "crypto: " << cipherEngine(id)->Name() << std::endl;
+
+    for (size_t size : {0, 1, 15, 16, 17, 42, 4096}) {
+      std::string plaintext = testBytes(size, id * 100 + size);
+      uint64_t before = std::chrono::duration_cast<std::chrono::seconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+      std::string cipher = pm.encrypt(plaintext);
+
+      CHECK(!PasswordManager::IsLegacy(cipher));
+      CHECK(static_cast<uint8_t>(cipher[0]) == SEALED_MAGIC);
+      CHECK(cipher[1] == SEALED_VERSION);
+      CHECK(static_cast<uint8_t>(cipher[2]) == id);
+      CHECK(same(pm.decrypt(cipher), plaintext));
+      CHECK(same(pm.decryptSealed(cipher), plaintext));
+
+      // The time is stored little-endian whatever the host.
+      uint64_t time = 0;
+      for (size_t i = 0; i < 8; ++i) {
+        time |= uint64_t(static_cast<uint8_t>(cipher[SEALED_HEADER_SIZE_V1 +
+                                                     i]))
+                << (8 * i);
+      }
+      CHECK(time == PasswordManager::SealedTime(cipher));
+      CHECK(time >= before && time <= before + 60);
+
+      // Any changed byte, header included, fails authentication.
+      for (size_t at = 1; at < cipher.size(); at += 5) {
+        std::string tampered = cipher;
+        tampered[at] ^= 0x01;
+        CHECK(throws([&] { pm.decrypt(tampered); }));
+        CHECK(throws([&] { pm.decryptSealed(tampered); }));
+      }
+      CHECK(throws([&] { other.decrypt(cipher); }));
+      CHECK(throws([&] { other.decryptSealed(cipher); }));
+    }
+
+    SecureStrings plaintexts;
+    for (size_t i = 0; i < 64; ++i) {
+      std::string plaintext = testBytes(i, i);
+      plaintexts.push_back(SecureString(plaintext.data(), plaintext.size()));
+    }
+    std::vector<std::string> ciphers(plaintexts.size());
+    SecureStrings opened(plaintexts.size());
+    pm.encryptMany(plaintexts.data(), plaintexts.size(), ciphers.data());
+    pm.decryptMany(ciphers.data(), ciphers.size(), opened.data());
+    CHECK(opened == plaintexts);
+  }
+
+  // Legacy entries still decrypt, but never pass as sealed.
+  PasswordManager pm(secret);
+  for (size_t size : {0, 1, 15, 16, 42}) {
+    std::string plaintext = testBytes(size, size + 5);
+    std::string cipher = legacyEncrypt(secret, plaintext);
+    CHECK(PasswordManager::IsLegacy(cipher));
+    CHECK(PasswordManager::SealedTime(cipher) == 0);
+    CHECK(same(pm.decrypt(cipher), plaintext));
+    CHECK(throws([&] { pm.decryptSealed(cipher); }));
+
+    bool legacy = false;
+    std::string seen;
+    pm.withPlaintext(
+        cipher, [&seen](std::string_view password) { seen = password; },
+        nullptr, &legacy);
+    CHECK(legacy && seen == plaintext);
+  }
+
+  std::string plaintext;
+  std::string cipher = legacyLookingSealed(secret, plaintext);
+  CHECK(same(pm.decrypt(cipher), plaintext));
+  CHECK(throws([&] { pm.decryptSealed(cipher); }));
+  CHECK(throws([&] { other.decrypt(cipher); }));
+  bool legacy = false;
+  pm.withPlaintext(cipher, [](std::string_view) {}, nullptr, &legacy);
+  CHECK(legacy);
+}
+
+// Names and ciphertexts of every entry in vault.
+static std::map<std::string, std::string> contents(const Vault &vault) {
+  std::map<std::string, std::string> entries;
+  vault.ForEach([&entries](const EntryView &entry) {
+    entries[std::string(entry.GetName())] = std::string(entry.GetPassword());
+  });
+  return entries;
+}
+
+static void putEntries(Vault &vault, PasswordManager &pm,
+                       const std::string &prefix, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    vault.Put(PasswordEntry(prefix + std::to_string(i),
+                            pm.encrypt(testBytes(20, i))));
+  }
+  vault.Commit();
+}
+
+static void checkShard(const fs::path &root) {
+  PasswordManager pm(SECRET);
+  for (int level : {0, 6}) {
+    fs::path dir = root / ("shard-" + std::to_string(level));
+    fs::create_directories(dir);
+    fs::path path = dir / "epm.bin";
+    std::map<std::string, std::string> expected;
+    {
+      Vault vault;
+      vault.Open(path);
+      putEntries(vault, pm, "entry-", 300);
+      Compression compression;
+      compression.level = level;
+      compression.blockSize = 1024;
+      vault.Compact(1, compression);
+      expected = contents(vault);
+      CHECK(expected.size() == 300);
+    }
+
+    std::string whole;
+    {
+      MappedFile file;
+      CHECK(file.Open(path));
+      whole.assign(file.Data(), file.Size());
+    }
+
+    // A file cut anywhere is refused when it is opened or read; it never
+    // yields entries that are not there or reads past the end.
+    fs::path cut = dir / "cut.bin";
+    size_t refused = 0;
+    size_t cuts = 0;
+    for (size_t size = 1; size < whole.size(); size += size < 256 ? 1 : 61) {
+      ++cuts;
+      {
+        std::ofstream out(cut, std::ios::binary | std::ios::trunc);
+        out.write(whole.data(), size);
+      }
+      bool rejected = throws([&] {
+        Vault vault;
+        vault.Open(cut);
+        std::map<std::string, std::string> seen = contents(vault);
+        for (const auto &entry : expected) {
+          vault.Find(entry.first);
+        }
+        if (seen != expected) {
+          throw std::runtime_error("truncated vault read differently");
+        }
+      });
+      refused += rejected;
+      if (!rejected) {
+        std::cerr << "shard: a copy cut to " << size << " of " << whole.size()
+                  << " bytes was accepted (level " << level << ")"
+                  << std::endl;
+      }
+    }
+    CHECK(refused == cuts);
+    fs::remove(cut);
+  }
+}
+
+static SyncReport sync(Vault &local, Vault &other, PasswordManager &pm) {
+  return syncVaults(local, other, pm,
+                    syncStatePath(local.Path(), other.Path()), lastWriterWins);
+}
+
+static void checkSync(const fs::path &root) {
+  PasswordManager pm(SECRET);
+  fs::path localPath = root / "sync-local" / "epm.bin";
+  fs::path otherPath = root / "sync-other" / "epm.bin";
+  fs::create_directories(localPath.parent_path());
+  fs::create_directories(otherPath.parent_path());
+
+  Vault local;
+  local.Open(localPath);
+  putEntries(local, pm, "a-", 50);
+
+  {
+    Vault other;
+    other.Open(otherPath);
+    SyncReport report = sync(local, other, pm);
+    CHECK(report.copiedToOther == 50);
+    CHECK(contents(other) == contents(local));
+    CHECK(local.KeyId() == pm.Fingerprint());
+    CHECK(other.KeyId() == pm.Fingerprint());
+
+    // Additions and deletions on either side are carried over.
+    local.Put(PasswordEntry("b-local", pm.encrypt("1")));
+    local.Remove("a-1");
+    local.Commit();
+    other.Put(PasswordEntry("b-other", pm.encrypt("2")));
+    other.Remove("a-2");
+    other.Commit();
+    report = sync(local, other, pm);
+    CHECK(report.removedFromLocal == 1 && report.removedFromOther == 1);
+    CHECK(report.copiedToLocal == 1 && report.copiedToOther == 1);
+    CHECK(contents(other) == contents(local));
+    CHECK(contents(local).size() == 50);
+
+    // Deleting every entry on one side empties the other.
+    for (const auto &entry : contents(other)) {
+      other.Remove(entry.first);
+    }
+    other.Commit();
+    sync(local, other, pm);
+    CHECK(contents(local).empty());
+    CHECK(contents(other).empty());
+
+    // A vault synced with another key is refused, and nothing is written.
+    PasswordManager stranger(OTHER_SECRET);
+    local.Put(PasswordEntry("c-0", pm.encrypt("3")));
+    local.Commit();
+    CHECK(throws([&] { sync(local, other, stranger); }));
+    CHECK(contents(other).empty());
+    sync(local, other, pm);
+    CHECK(contents(other).size() == 1);
+  }
+
+  // A vault created again in place of the one synced before is filled, not
+  // emptied into the other.
+  fs::remove_all(otherPath.parent_path());
+  fs::create_directories(otherPath.parent_path());
+  {
+    Vault other;
+    other.Open(otherPath);
+    sync(local, other, pm);
+    CHECK(contents(local).size() == 1);
+    CHECK(contents(other) == contents(local));
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> groups(argv + 1, argv + argc);
+  if (groups.empty()) {
+    groups = {"codec", "crypto", "shard", "sync"};
+  }
+
+  fs::path root = fs::temp_directory_path() /
+                  ("epm-check-" + std::to_string(getpid()));
+  fs::create_directories(root);
+  try {
+    for (const std::string &group : groups) {
+      if (group == "codec") {
+        checkCodec();
+      } else if (group == "crypto") {
+        checkCrypto();
+      } else if (group == "shard") {
+        checkShard(root);
+      } else if (group == "sync") {
+        checkSync(root);
+      } else {
+        std::cerr << "Usage: " << argv[0] << " [codec] [crypto] [shard] [sync]"
+                  << std::endl;
+        fs::remove_all(root);
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "check failed: " << e.what() << std::endl;
+    ++failures;
+  }
+  fs::remove_all(root);
+
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all checks passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef __AGENT_H__
+#define __AGENT_H__
+
+#include "encryption.h"
+#include "vault.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Requests and replies are frames of a 32-bit length followed by that many
+// bytes. A request is a command and its arguments separated by NUL bytes
+// ("get\0<name>", "list", "add\0<name>\0<password>", "lock"). A reply starts
+// with one of the status bytes below; list replies carry NUL-separated names.
+#define AGENT_OK 'O'
+#define AGENT_NOT_FOUND 'N'
+#define AGENT_ERROR 'E'
+
+#define AGENT_MAX_IDLE (365 * 24 * 3600) // longest idle timeout, in seconds
+
+// Keeps an unlocked vault in memory and answers requests from short-lived
+// clients on a Unix domain socket that only the owning user may use. Request
+// and reply buffers live in the secure arena, which is wiped after each
+// request.
+class Agent {
+public:
+  Agent(Vault &vault, PasswordManager &pm, const fs::path &socketPath);
+
+  // Serve requests until the agent is idle for idleSeconds, receives a lock
+  // request or is interrupted. Throws std::runtime_error if the socket cannot
+  // be created.
+  void Serve(unsigned idleSeconds);
+
+private:
+  Vault &vault;
+  PasswordManager &pm;
+  fs::path socketPath;
+  fs::path vaultPath;
+
+  // Returns false once the agent should lock.
+  bool handle(const std::vector<SecureString> &request, SecureString &reply);
+};
+
+// Send a request to the agent listening on socketPath and store its reply.
+// Returns false if no agent is running.
+bool agentRequest(const fs::path &socketPath,
+                  const std::vector<std::string> &request, SecureString &reply);
+
+#endif /* __AGENT_H__ */
@@ -0,0 +1,66 @@
+#ifndef __CIPHER_H__
+#define __CIPHER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Authenticated ciphers an entry can be sealed with. A sealed password is
+//
+//   SEALED_MAGIC | SEALED_VERSION | CipherId | write time | engine output
+//
+// and the header is authenticated along with it. The write time is when the
+// password was sealed, in little-endian seconds since the epoch, so that sync
+// can tell the newer of two versions of an entry. Version 1 headers end
+// before it. Passwords written before sealing existed are bare AES-128-ECB
+// blocks and are told apart by the header. A few of them start like one by
+// chance, so one that fails to authenticate is read as legacy after all,
+// unless the caller asked for a sealed entry.
+#define SEALED_MAGIC 0xEC
+#define SEALED_VERSION 2
+#define SEALED_HEADER_SIZE 11
+#define SEALED_HEADER_SIZE_V1 3
+#define CIPHER_KEY_SIZE 32
+
+enum CipherId : uint8_t {
+  CIPHER_AES_256_GCM = 1,        // OpenSSL EVP, AES-NI/VAES where available
+  CIPHER_XCHACHA20_POLY1305 = 2, // libsodium
+};
+
+class CipherEngine {
+public:
+  virtual ~CipherEngine() = default;
+
+  virtual CipherId Id() const = 0;
+  // Name used in the key file, e.g. "aes256gcm".
+  virtual const char *Name() const = 0;
+  // Bytes the engine adds to a plaintext: nonce and tag.
+  virtual size_t Overhead() const = 0;
+
+  // Seal plaintext under key with a fresh random nonce, authenticating ad as
+  // well. Writes Overhead() + plaintext.size() bytes to out.
+  virtual void Seal(const uint8_t *key, std::string_view ad,
+                    std::string_view plaintext, char *out) const = 0;
+
+  // Open sealed, which has room for sealed.size() bytes of plaintext at out.
+  // Returns false if sealed or ad fail authentication.
+  virtual bool Open(const uint8_t *key, std::string_view ad,
+                    std::string_view sealed, char *out,
+                    size_t &length) const = 0;
+};
+
+// Set up OpenSSL and libsodium. Runs once per process, on the first call;
+// every function that needs either library calls it, so commands that
+// decrypt nothing never pay for it. Throws if libsodium cannot be used.
+void cryptoInit();
+
+// The engine for id, or nullptr if there is none.
+const CipherEngine *cipherEngine(uint8_t id);
+
+// The engine with the given name, or nullptr if there is none.
+const CipherEngine *cipherEngineNamed(std::string_view name);
+
+// Time every engine on short messages and return the fastest one here.
+CipherId fastestCipher();
+
+#endif /* __CIPHER_H__ */
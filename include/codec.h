@@ -0,0 +1,40 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// Base64 (RFC 4648, padded, no line breaks) and hex codecs over caller-owned
+// buffers. The fastest kernel the CPU supports (AVX2, SSSE3 or portable
+// scalar code) is picked on first use; set EPM_CODEC=scalar|ssse3|avx2 to
+// force one, e.g. for benchmarking.
+namespace codec {
+
+// Name of the kernel in use.
+const char *kernelName();
+
+// Exact output size of base64Encode for n input bytes.
+inline size_t base64EncodedSize(size_t n) { return (n + 2) / 3 * 4; }
+
+// Buffer size that is always enough for base64Decode of n input characters.
+inline size_t base64DecodedMaxSize(size_t n) { return (n + 3) / 4 * 3; }
+
+// Encode n bytes from src into dst, which must hold base64EncodedSize(n)
+// characters. Returns the number of characters written.
+size_t base64Encode(const uint8_t *src, size_t n, char *dst);
+
+// Decode n characters from src into dst, which must hold
+// base64DecodedMaxSize(n) bytes. Whitespace is skipped. Returns false if the
+// input is not valid base64; otherwise stores the decoded size in written.
+bool base64Decode(const char *src, size_t n, uint8_t *dst, size_t *written);
+
+// Encode n bytes into 2 * n hex digits.
+void hexEncode(const uint8_t *src, size_t n, char *dst, bool upper = false);
+
+// Decode n hex digits (either case) into n / 2 bytes. Returns false if n is
+// odd or the input contains anything but hex digits.
+bool hexDecode(const char *src, size_t n, uint8_t *dst);
+
+} // namespace codec
+
+#endif /* __CODEC_H__ */
@@ -0,0 +1,111 @@
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include "password.h"
+#include "utils.h"
+#include "vault.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Content digests that let two vaults be compared without reading either in
+// full.
+//
+// Every entry has a digest of its name and sealed password. Names are spread
+// over DIGEST_BUCKETS buckets by a hash that does not depend on the shards,
+// and a bucket's digest is the XOR of the digests of its entries. Vaults that
+// agree on a bucket digest hold the same entries in that bucket, so only the
+// entries of differing buckets need to be listed. XOR lets a bucket digest be
+// put together from any number of shards and updated one entry at a time; it
+// catches accidents, not entries crafted to collide.
+//
+// The digests of a shard's indexed file are kept in a .sum file next to it,
+// written on first use and again after the file is compacted:
+//
+//   DigestFileHeader | uint64_t start[DIGEST_BUCKETS + 1] |
+//   Digest bucket[DIGEST_BUCKETS] | entries
+//
+// where entries hold (varint name length | name | Digest) for each bucket in
+// turn, sorted by name, and start[b] is the offset of bucket b's first entry
+// from the start of entries. The log is small and its entries are hashed as
+// the digests are loaded.
+#define DIGEST_SIZE 16
+#define DIGEST_BUCKETS 1024
+
+typedef std::array<uint8_t, DIGEST_SIZE> Digest;
+
+struct DigestFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t buckets;
+  uint32_t reserved;
+  uint64_t count;
+  // Shard::IndexedSize and IndexedTime of the file the digests are of.
+  uint64_t indexedSize;
+  int64_t indexedTime;
+};
+
+// Digest of an entry's name and sealed password.
+Digest entryDigest(const EntryView &entry);
+
+// Bucket that name belongs to, below DIGEST_BUCKETS.
+size_t digestBucket(std::string_view name);
+
+struct DigestedEntry {
+  std::string_view name;
+  Digest digest;
+};
+
+class VaultDigests {
+public:
+  VaultDigests() = default;
+
+  VaultDigests(const VaultDigests &) = delete;
+  VaultDigests &operator=(const VaultDigests &) = delete;
+
+  // Load the digests of every live entry of vault, opening all its shards.
+  // A shard whose .sum file is missing, stale or damaged is hashed and the
+  // file written again. Throws std::runtime_error if it cannot be written.
+  void Load(const Vault &vault);
+
+  const Digest &Bucket(size_t bucket) const { return buckets[bucket]; }
+
+  // Number of live entries.
+  size_t Size() const { return size; }
+
+  // The live entries of bucket, sorted by name. The names stay valid until
+  // the vault is changed or the digests are loaded again.
+  std::vector<DigestedEntry> Entries(size_t bucket) const;
+
+  // Account for a change to the vault: name had digest before and now has
+  // after; either is empty if there was or is no such entry.
+  void Update(std::string_view name, const std::optional<Digest> &before,
+              const std::optional<Digest> &after);
+
+private:
+  struct Sums {
+    MappedFile file;
+    const uint64_t *starts = nullptr;
+    const Digest *buckets = nullptr;
+    const char *entries = nullptr;
+  };
+
+  std::vector<std::unique_ptr<Sums>> shards;
+  std::vector<Digest> buckets;
+  size_t size = 0;
+  // Per bucket, the names the logs override: their digest, or none if they
+  // were removed.
+  std::vector<std::map<std::string, std::optional<Digest>, std::less<>>>
+      logged;
+
+  bool open(Sums &sums, const fs::path &path, const Shard &shard) const;
+};
+
+#endif /* __DIGEST_H__ */
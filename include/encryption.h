@@ -1,35 +1,119 @@
 #ifndef __ENCRYPTION_H__
 #define __ENCRYPTION_H__
 
+#include "cipher.h"
+#include "secure.h"
+
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <string>
+#include <string_view>
+#include <vector>
+
+// Argon2 settings a key is derived with. They are stored in the key file so
+// that VerifyKey repeats exactly the same work.
+struct KdfParams {
+  int alg;
+  unsigned long long opsLimit;
+  size_t memLimit;
+};
+
+// epm.key holds a header line with the KDF settings and the entry cipher
+// followed by the derived key and its salt in hex. Files from older releases
+// are just the hex string and use the interactive limits; they, and header
+// lines without a cipher, get AES-256-GCM.
+SecureString formatKeyFile(std::string_view secret, const KdfParams &params,
+                           CipherId cipher);
+// Returns false if text is not a valid key file.
+bool parseKeyFile(std::string_view text, SecureString &secret,
+                  KdfParams &params, CipherId &cipher);
 
 class PasswordManager {
 public:
   // PasswordManager constructor
   PasswordManager() = default;
 
-  // PasswordManager constructor
-  PasswordManager(const std::string secretKey);
+  // PasswordManager constructor. New entries are sealed with cipher.
+  PasswordManager(std::string_view secretKey,
+                  CipherId cipher = CIPHER_AES_256_GCM);
+
+  // Seals the given plaintext with the manager's cipher and a fresh nonce.
+  std::string encrypt(std::string_view plaintext,
+                      const SecureString *secret = nullptr);
+
+  // Opens a sealed ciphertext, or decrypts one written with the legacy
+  // AES-128-ECB cipher. One that starts like a sealed ciphertext but fails
+  // authentication is tried as legacy; throws if that fails too.
+  SecureString decrypt(std::string_view ciphertext,
+                       const SecureString *secret = nullptr);
 
-  ~PasswordManager();
+  // Like decrypt, but a legacy ciphertext throws too, and a sealed one that
+  // fails authentication is never tried as legacy: only a sealed one can
+  // prove it was written under this key.
+  SecureString decryptSealed(std::string_view ciphertext);
 
-  // Encrypts the given plaintext and returns the ciphertext in base64 format.
-  std::string encrypt(const std::string &plaintext,
-                      const std::string *secret = nullptr);
+  // Decrypts ciphertext into a buffer in the secure arena, passes the
+  // plaintext to fn and wipes the buffer afterwards, so that reading one
+  // secret leaves no copy of it behind. If legacy is given, it is set before
+  // fn runs to whether the ciphertext turned out to be legacy.
+  void withPlaintext(std::string_view ciphertext,
+                     const std::function<void(std::string_view)> &fn,
+                     const SecureString *secret = nullptr,
+                     bool *legacy = nullptr);
 
-  // Decrypts the given ciphertext in base64 format and returns the plaintext.
-  std::string decrypt(const std::string &b64_cipher,
-                      const std::string *secret = nullptr);
+  // Batch variants for whole-vault work. Each output string is overwritten in
+  // place, so callers that reuse their output vector avoid reallocating. The
+  // key schedule is set up once per thread and reused across calls.
+  void encryptMany(const SecureString *plaintexts, size_t count,
+                   std::string *ciphertexts,
+                   const SecureString *secret = nullptr);
+  void decryptMany(const std::string *ciphertexts, size_t count,
+                   SecureString *plaintexts,
+                   const SecureString *secret = nullptr);
+  void decryptMany(const std::string_view *ciphertexts, size_t count,
+                   SecureString *plaintexts,
+                   const SecureString *secret = nullptr);
+
+  CipherId Cipher() const { return cipher; }
+
+  // True if ciphertext carries no sealed header, so it was written with the
+  // legacy cipher. Such entries are sealed again whenever a command reads
+  // them.
+  static bool IsLegacy(std::string_view ciphertext);
+
+  // When ciphertext was sealed, in seconds since the epoch; 0 if it is
+  // legacy or from before sealed entries carried the time. Only opening the
+  // ciphertext authenticates it.
+  static uint64_t SealedTime(std::string_view ciphertext);
+
+  // Overwrite the secret key with zeros and forget it. The key lives in the
+  // secure arena, so it is never swapped out in the meantime.
+  void wipeSecret();
+
+  // libsodium's interactive limits, the defaults before keys carried their
+  // own settings.
+  static KdfParams InteractiveKdfParams();
+
+  // Measure this machine and pick Argon2id limits that take about targetMs:
+  // memory is scaled first (up to libsodium's moderate limit), then passes.
+  static KdfParams CalibrateKdf(unsigned targetMs);
 
   // Generate a new secret key
-  std::string GenerateKey(std::string masterPassword);
+  SecureString GenerateKey(std::string_view masterPassword,
+                           const KdfParams &params = InteractiveKdfParams());
+
+  bool VerifyKey(std::string_view generatedKey, std::string_view masterPassword,
+                 const KdfParams &params = InteractiveKdfParams());
 
-  bool VerifyKey(const std::string &generatedKey,
-                 const std::string &masterPassword);
+  // Short non-zero identifier of a generated key, stored with the vault to
+  // tell which key its entries are encrypted with.
+  static uint32_t KeyFingerprint(std::string_view key);
+  // KeyFingerprint of the manager's own key.
+  uint32_t Fingerprint() const { return KeyFingerprint(secretKey); }
 
   // Helper functions
   // encode binary data to base64
@@ -43,10 +127,12 @@ public:
   static std::string hexDecode(const std::string &hexData);
 
 private:
-  std::string secretKey;
+  SecureString secretKey;
+  std::vector<uint8_t, SecureAllocator<uint8_t>> entryKey;
+  CipherId cipher = CIPHER_AES_256_GCM;
 
-  void init_encryption();
-  void cleanup_encryption();
+  const uint8_t *keyFor(const SecureString *secret, uint8_t *scratch) const;
+  const CipherEngine *engine() const;
 };
 
 #endif /* __ENCRYPTION_H__ */
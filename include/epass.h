@@ -1,7 +1,10 @@
 #ifndef __EPASS_H__
 #define __EPASS_H__
 #include "encryption.h"
+#include "generator.h"
 #include "password.h"
+#include "records.h"
+#include "vault.h"
 
 #include <assert.h>
 #include <cstring>
@@ -9,7 +12,6 @@
 #include <fstream>
 #include <iostream>
 #include <string>
-#include <unordered_map>
 
 namespace fs = std::filesystem;
 
@@ -17,22 +19,83 @@ class Epass {
 public:
   // Default constructor.
   Epass();
-  void GenerateKey();
+  // Write a new key file. A non-zero targetMs calibrates the KDF to take
+  // about that long on this machine instead of using libsodium's defaults.
+  void GenerateKey(unsigned targetMs = 0);
   bool KeyExists();
-  void Init();
+  // Load the key and the vault. Prompts for the master password unless a
+  // recent unlock cached the key; a non-zero cacheSeconds caches it afterwards.
+  void Init(unsigned cacheSeconds = 0);
+  // Like Init, with a master password obtained by the caller. Returns false
+  // if it does not match the key.
+  bool Unlock(std::string_view masterPassword);
+  // Drop the key cached by Init. Returns false if none was cached.
+  bool Lock();
   void AddEntry(const std::string &name, const std::string &password);
   void PrintEntry(std::string name);
   void PrintRawEntry(std::string name);
   void DeleteEntry(std::string name);
   void ListEntries();
+  // Print up to limit names ranked by how well they fuzzy-match query. Names
+  // are stored in the clear, so this needs no key.
+  void SearchEntries(const std::string &query, size_t limit);
+  // Print the names starting with prefix for shell completion. Reads only the
+  // name order; never prompts, and prints nothing if the vault is unreadable.
+  void CompleteNames(const std::string &prefix);
+  // Encrypt every credential in input and commit them with a single write.
+  void ImportEntries(std::istream &input, RecordFormat format);
+  // Decrypt every entry and write it to output in chunks decrypted across
+  // all cores. Memory use is bounded by the chunk size, not the vault size.
+  void ExportEntries(std::ostream &output, RecordFormat format);
+  // Write count passwords from generator to output, one per line. Needs no
+  // key.
+  void PrintGenerated(std::ostream &output, size_t count,
+                      PasswordGenerator &generator);
+  // Store count passwords from generator under names made from pattern by
+  // replacing {n} with 1..count, in a single write. Refuses to replace
+  // existing entries.
+  void StoreGenerated(const std::string &pattern, size_t count,
+                      PasswordGenerator &generator);
+  // Run the add, get, delete, list and commit commands in input, one per
+  // line, against the unlocked vault. Changes are written together at each
+  // commit and at the end; a malformed line aborts the batch before anything
+  // since the last commit is written.
+  void RunBatch(std::istream &input);
+  // Keep the unlocked vault in memory and serve it over the agent socket.
+  void RunAgent(unsigned idleSeconds);
+  // Socket a running agent listens on.
+  fs::path AgentSocket() const;
+  // Prompt for the current and a new master password, then re-encrypt every
+  // entry under a key derived from the new one.
+  void Rekey();
+  // Re-encrypt an unlocked vault under a key derived from newPassword. The
+  // vault and the key file are switched over together.
+  void Rekey(std::string_view newPassword);
+  // Fold the change logs into the indexed vault files. A non-zero shards
+  // also spreads the entries over that many shard files (1: a single file);
+  // compression changes how they store their records.
+  void Compact(size_t shards = 0,
+               std::optional<Compression> compression = std::nullopt);
+  // Merge the vault with the one at target, a vault file or the directory
+  // holding it, so that both end up with the same entries. Entries changed
+  // on both sides go to the version written last, or to the user's choice
+  // when interactive.
+  void Sync(const fs::path &target, bool interactive);
 
 private:
   fs::path path;
   fs::path baseDir;
-  std::unordered_map<std::string, PasswordEntry> entries;
+  Vault vault;
   PasswordManager pm;
+  KdfParams kdf = PasswordManager::InteractiveKdfParams(); // from the key file
+  CipherId cipher = CIPHER_AES_256_GCM;                    // from the key file
 
+  SecureString requestNewPassword();
+  SecureString readKey();
+  std::string keyDescription() const;
+  void openVault();
   void save();
+  bool printPassword(const EntryView &entry);
 };
 
 #endif /* __EPASS_H__ */
@@ -0,0 +1,85 @@
+#ifndef __EPM_H__
+#define __EPM_H__
+
+// C interface to an epm vault, for services that look secrets up in-process:
+// unlock once with epm_open, then call epm_get as often as needed without
+// another KDF run. No function prints or exits; each returns a status and,
+// on failure, leaves a message for epm_last_error.
+//
+// A handle may be used by one thread at a time. Threads that need their own
+// can each open one.
+
+#include <stddef.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define EPM_API
+#else
+#define EPM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Raised when a function is removed or changes meaning; additions keep it.
+#define EPM_API_VERSION 1
+
+typedef enum epm_status {
+  EPM_OK = 0,
+  EPM_NOT_FOUND = 1,        // no entry with that name
+  EPM_BAD_PASSWORD = 2,     // the master password does not match the key
+  EPM_NO_KEY = 3,           // no key file; run 'epm keygen' first
+  EPM_INVALID_ARGUMENT = 4, // a NULL, empty or oversized argument
+  EPM_BUFFER_TOO_SMALL = 5, // see epm_get
+  EPM_ERROR = 6             // I/O error, corrupt files or a changed key
+} epm_status;
+
+typedef struct epm_vault epm_vault;
+
+// EPM_API_VERSION of the library loaded at run time.
+EPM_API int epm_api_version(void);
+
+// Open the vault in dir, the directory holding epm.key and epm.bin, or in the
+// platform's configuration directory if dir is NULL, and unlock it with
+// master_password. On success *vault is a new handle, to be released with
+// epm_close.
+EPM_API epm_status epm_open(const char *dir, const char *master_password,
+                            epm_vault **vault);
+
+// Wipe the key and release the handle. NULL is ignored.
+EPM_API void epm_close(epm_vault *vault);
+
+// Copy the password of name to buffer, which holds size bytes, followed by a
+// NUL. *length is set to the length of the password without the NUL, also on
+// EPM_BUFFER_TOO_SMALL so that the caller can retry with a larger buffer.
+// Commits by other processes are picked up first.
+EPM_API epm_status epm_get(epm_vault *vault, const char *name, char *buffer,
+                           size_t size, size_t *length);
+
+// Add or replace the entry name and commit it.
+EPM_API epm_status epm_put(epm_vault *vault, const char *name,
+                           const char *password);
+
+// Remove the entry name and commit. EPM_NOT_FOUND if there is none.
+EPM_API epm_status epm_remove(epm_vault *vault, const char *name);
+
+// Call fn with every name, in byte order, and ctx. A name is not
+// NUL-terminated and is only valid during its call.
+EPM_API epm_status epm_list(epm_vault *vault,
+                            void (*fn)(const char *name, size_t length,
+                                       void *ctx),
+                            void *ctx);
+
+// Message for the last failure on the calling thread, or "" after a success.
+// Valid until the thread's next call into the library.
+EPM_API const char *epm_last_error(void);
+
+// Zero size bytes at p, such as a buffer filled by epm_get, in a way the
+// compiler does not optimise away.
+EPM_API void epm_wipe(void *p, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __EPM_H__ */
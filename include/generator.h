@@ -0,0 +1,68 @@
+#ifndef __GENERATOR_H__
+#define __GENERATOR_H__
+
+#include "secure.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Character classes a generated password draws from.
+#define CLASS_LOWER 1
+#define CLASS_UPPER 2
+#define CLASS_DIGIT 4
+#define CLASS_SYMBOL 8
+#define CLASS_ALL (CLASS_LOWER | CLASS_UPPER | CLASS_DIGIT | CLASS_SYMBOL)
+
+// Parse a comma-separated list such as "lower,upper,digit" into classes.
+// Returns false on an unknown or empty list.
+bool parseCharClasses(std::string_view list, unsigned &classes);
+
+// Generates passwords of a fixed length, uniformly over the strings of the
+// charset that contain at least one character of every selected class.
+//
+// Random bytes are drawn from libsodium in large batches and mapped to
+// characters through a 256-entry table in one pass. Bytes at or above the
+// largest multiple of the charset size are dropped, so that every character
+// is equally likely, and the pass has no data-dependent branch. Both buffers
+// live in the secure arena, which zeroes them when they are freed.
+class PasswordGenerator {
+public:
+  // Throws std::runtime_error if length cannot hold one character of every
+  // class.
+  PasswordGenerator(unsigned classes, size_t length);
+
+  PasswordGenerator(const PasswordGenerator &) = delete;
+  PasswordGenerator &operator=(const PasswordGenerator &) = delete;
+
+  size_t Length() const { return length; }
+
+  // Bits of entropy of one password: length * log2(charset size), less the
+  // little that requiring every class takes away.
+  double EntropyBits() const;
+
+  // Shortest length whose passwords with classes carry at least bits.
+  static size_t LengthFor(unsigned classes, double bits);
+
+  // Write Length() characters of a new password to out.
+  void Generate(char *out);
+
+private:
+  typedef std::vector<unsigned char, SecureAllocator<unsigned char>> Buffer;
+
+  std::string charset;
+  unsigned classes;
+  size_t length;
+  unsigned char table[256];   // byte -> character
+  unsigned char accept[256];  // 1 if the byte maps without bias
+  unsigned char classOf[256]; // character -> its class bit
+
+  Buffer random;
+  Buffer mapped;   // characters from the last batch, zeroed as they are used
+  size_t next = 0; // first unused character of mapped
+
+  void refill();
+};
+
+#endif /* __GENERATOR_H__ */
@@ -7,6 +7,8 @@
 #include <termios.h>
 #include <unistd.h>
 #endif
+#include "secure.h"
+
 #include <iostream>
 
 // Enumerator
@@ -18,7 +20,8 @@ enum IN {
 
 };
 
-// Function that accepts the password
-std::string requestUserPassword(const std::string &prompt, char echoChar = '*');
+// Function that accepts the password. The result is kept in the secure arena.
+SecureString requestUserPassword(const std::string &prompt,
+                                 char echoChar = '*');
 
 #endif /* __INPUT_H__ */
@@ -0,0 +1,27 @@
+#ifndef __KEYFILE_H__
+#define __KEYFILE_H__
+
+#include "encryption.h"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Names of the key file and of the new key a rekey writes next to it, in the
+// directory that holds the vault.
+#define KEY_FILE "epm.key"
+#define REKEY_FILE "epm.key.rekey"
+
+// A rekey writes the new key next to the old one, then the re-encrypted
+// vault, then renames the new key into place. The vault write is the commit
+// point: if the vault at vaultPath carries the new key's fingerprint the
+// rename is finished here, otherwise the new key never took effect and is
+// dropped. Does nothing while the vault cannot be read.
+void recoverRekey(const fs::path &baseDir, const fs::path &vaultPath);
+
+// Read the key file in baseDir. Returns false if there is none; throws
+// std::runtime_error if it cannot be read or parsed.
+bool readKeyFile(const fs::path &baseDir, SecureString &secret, KdfParams &kdf,
+                 CipherId &cipher);
+
+#endif /* __KEYFILE_H__ */
@@ -0,0 +1,27 @@
+#ifndef __KEYRING_H__
+#define __KEYRING_H__
+
+#include "secure.h"
+
+#include <string>
+#include <string_view>
+
+// Short-lived cache of the verified secret key in the Linux session keyring.
+// The kernel drops the key when its timeout expires or the keyring goes away.
+// Inside a login session only processes of that session can read it; a
+// process started outside one falls back to the per-user session keyring,
+// which every process of the same user can search, in any session, until
+// the timeout. On other platforms every call reports that nothing is cached.
+
+// Store secret under description, expiring after ttlSeconds. Replaces any
+// key already stored under that description. Returns false on failure.
+bool keyringStore(const std::string &description, std::string_view secret,
+                  unsigned ttlSeconds);
+
+// Fetch the secret stored under description. Returns false if there is none.
+bool keyringLoad(const std::string &description, SecureString &secret);
+
+// Remove the secret stored under description. Returns false if there was none.
+bool keyringClear(const std::string &description);
+
+#endif /* __KEYRING_H__ */
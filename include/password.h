@@ -1,34 +1,90 @@
 #ifndef PASSWORD_H
 #define PASSWORD_H
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <string_view>
 
-class PasswordEntry {
+// Upper bounds accepted when reading a record, to reject corrupted lengths
+// before allocating for them.
+#define ENTRY_MAX_NAME 4096
+#define ENTRY_MAX_PASSWORD 65536
+
+// Longest plaintext secret accepted, leaving room for cipher overhead.
+#define ENTRY_MAX_SECRET (ENTRY_MAX_PASSWORD - 64)
+
+// Size of a record in the fixed-width layout used by vault versions 0 and 1.
+#define FIXED_NAME_SIZE 64
+#define FIXED_PASSWORD_SIZE 128
+#define FIXED_ENTRY_SIZE (FIXED_NAME_SIZE + FIXED_PASSWORD_SIZE)
 
+class PasswordEntry;
+
+// Non-owning view of an entry: name and ciphertext point into a mapped vault
+// file or into an entry the vault holds in memory. A view stays valid until
+// the vault it came from is changed, compacted or reopened; copy it into a
+// PasswordEntry to keep it longer.
+class EntryView {
 public:
-  PasswordEntry() noexcept;
-  PasswordEntry(const std::string &name, const std::string &password) noexcept;
+  EntryView() noexcept = default;
+  EntryView(std::string_view name, std::string_view password) noexcept
+      : name(name), password(password) {}
+  EntryView(const PasswordEntry &entry) noexcept;
 
-  void SetPassword(const std::string &password);
-  void SetName(const std::string &name);
+  std::string_view GetName() const { return name; }
+  std::string_view GetPassword() const { return password; }
 
-  std::string GetName() const;
-  std::string GetPassword() const;
+  // Append the record as <varint name length><varint password length>
+  // <name><password>.
+  void Serialize(std::string &output) const;
 
-  void Serialize(std::ostream &output) const;
-  void Deserialize(std::istream &input);
+  // Point at the record written by Serialize at [input, end) and advance
+  // input past it. Returns false if the record is truncated or oversized.
+  bool Deserialize(const char *&input, const char *end);
 
-  friend std::ostream &operator<<(std::ostream &os,
-                                  const PasswordEntry &entry) {
+  // Point at a fixed-width record from an older vault. Both fields are
+  // NUL-padded and not NUL-terminated when full.
+  void DeserializeFixed(const char *input);
+
+  friend std::ostream &operator<<(std::ostream &os, const EntryView &entry) {
     os << "Name: " << entry.GetName() << std::endl;
     os << "Password: " << entry.GetPassword() << std::endl;
     return os;
   }
 
 private:
-  char name[64];
-  char password[128];
+  std::string_view name;
+  std::string_view password;
 };
 
+class PasswordEntry {
+
+public:
+  PasswordEntry() noexcept = default;
+  PasswordEntry(const std::string &name, const std::string &password);
+  explicit PasswordEntry(const EntryView &view);
+
+  void SetPassword(const std::string &password);
+  void SetName(const std::string &name);
+
+  const std::string &GetName() const { return name; }
+  const std::string &GetPassword() const { return password; }
+
+  // Same record format as EntryView, copied into the entry.
+  void Serialize(std::string &output) const;
+  bool Deserialize(const char *&input, const char *end);
+  void DeserializeFixed(const char *input);
+
+private:
+  std::string name;
+  std::string password;
+};
+
+// Append value as a LEB128 varint.
+void putVarint(std::string &output, uint64_t value);
+
+// Decode a LEB128 varint from [input, end) and advance input past it.
+bool getVarint(const char *&input, const char *end, uint64_t &value);
+
 #endif /* PASSWORD_H */
@@ -0,0 +1,80 @@
+#ifndef __RECORDS_H__
+#define __RECORDS_H__
+
+#include "secure.h"
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Plaintext credential exchanged with other tools.
+struct Credential {
+  std::string name;
+  SecureString password;
+};
+
+enum class RecordFormat { CSV, JSONL };
+
+// Parse a format name ("csv", "jsonl"/"json"). Returns false if unknown.
+bool parseRecordFormat(const std::string &name, RecordFormat &format);
+
+// Streams credentials out of CSV (name,password with optional header row and
+// RFC 4180 quoting) or JSON lines ({"name": ..., "password": ...}). Input is
+// parsed in the secure arena, since it holds the passwords in the clear.
+class RecordReader {
+public:
+  RecordReader(std::istream &input, RecordFormat format);
+
+  // Read the next record. Returns false at the end of the input.
+  // Throws std::runtime_error on malformed input.
+  bool Next(Credential &record);
+
+  // Line number of the last record read, for error messages.
+  size_t Line() const { return line; }
+
+private:
+  std::istream &input;
+  RecordFormat format;
+  size_t line = 0;
+  size_t nextLine = 1;
+  bool first = true;
+
+  bool nextCSV(Credential &record);
+  bool nextJSON(Credential &record);
+};
+
+// Writes credentials in a form RecordReader reads back: CSV with a header row
+// and RFC 4180 quoting where needed, or JSON lines. Records are gathered in a
+// buffer in the secure arena that is written out in large blocks and wiped
+// afterwards, since it holds plaintext.
+class RecordWriter {
+public:
+  RecordWriter(std::ostream &output, RecordFormat format);
+
+  RecordWriter(const RecordWriter &) = delete;
+  RecordWriter &operator=(const RecordWriter &) = delete;
+
+  void Write(std::string_view name, std::string_view password);
+
+  // Write out everything buffered. Throws std::runtime_error if the output
+  // fails.
+  void Flush();
+
+private:
+  std::ostream &output;
+  RecordFormat format;
+  SecureString buffer;
+
+  void appendCSV(std::string_view field);
+  void appendJSON(std::string_view value);
+};
+
+// Split a command line into words separated by blanks. A word may be quoted
+// with "..." (where \" and \\ are escapes) or '...' (taken literally), and a
+// backslash outside quotes escapes the next character. Returns false if a
+// quote is left open.
+bool splitWords(const std::string &line, std::vector<std::string> &words);
+
+#endif /* __RECORDS_H__ */
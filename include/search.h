@@ -0,0 +1,12 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include <string_view>
+
+// Score how well query matches name as a case-insensitive subsequence.
+// Matches at word starts (after '/', '.', '-', ...) and runs of consecutive
+// characters score higher; gaps and a late start cost a little. Returns -1 if
+// the characters of query do not all appear in name in order.
+int fuzzyScore(std::string_view query, std::string_view name);
+
+#endif /* __SEARCH_H__ */
@@ -0,0 +1,125 @@
+#ifndef __SECURE_H__
+#define __SECURE_H__
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Memory for secrets: master passwords, keys and decrypted passwords.
+//
+// The arena hands out memory from chunks taken from sodium_malloc, which are
+// locked into RAM so that they never reach swap, and zeroed and released when
+// the process exits. Freeing a block zeroes it right away. The most recent
+// block is taken back at once; any other is kept for the next allocation of
+// the same size, so a process that never ends a Scope, such as one using
+// libepm, reuses its memory instead of growing. A Scope zeroes whatever was
+// handed out since it began in one pass, so a command or an agent request
+// ends with a single wipe instead of many scattered frees.
+class SecureArena {
+public:
+  SecureArena() = default;
+  ~SecureArena();
+
+  SecureArena(const SecureArena &) = delete;
+  SecureArena &operator=(const SecureArena &) = delete;
+
+  // The arena used by SecureAllocator.
+  static SecureArena &Instance();
+
+  // Throws std::bad_alloc if no memory is left.
+  void *Allocate(size_t size);
+  void Deallocate(void *p, size_t size);
+
+  // Zero everything handed out and start over. Memory still in use must not
+  // be touched afterwards.
+  void Reset();
+
+  // Bytes handed out and not yet returned by a Reset or a Scope, including
+  // freed blocks kept for reuse.
+  size_t Used() const;
+
+  // Zeroes and takes back everything allocated during its lifetime. Secure
+  // objects created inside a scope must not outlive it.
+  class Scope {
+  public:
+    explicit Scope(SecureArena &arena = Instance());
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    SecureArena &arena;
+    size_t chunk;
+    size_t used;
+  };
+
+private:
+  struct Chunk {
+    char *data;
+    size_t size;
+    size_t used;
+  };
+
+  mutable std::mutex mutex;
+  std::vector<Chunk> chunks;
+  size_t current = 0; // chunk allocations are served from
+  // Freed blocks below the top of their chunk, zeroed, by size.
+  std::unordered_map<size_t, std::vector<char *>> freeBlocks;
+
+  void release(size_t chunk, size_t used);
+};
+
+// Allocator for standard containers that hold secrets.
+template <typename T> struct SecureAllocator {
+  typedef T value_type;
+
+  SecureAllocator() noexcept = default;
+  template <typename U> SecureAllocator(const SecureAllocator<U> &) noexcept {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(SecureArena::Instance().Allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) noexcept {
+    SecureArena::Instance().Deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const SecureAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const SecureAllocator<U> &) const {
+    return false;
+  }
+};
+
+// A string kept in the arena. Short strings live inside the object itself,
+// so it is zeroed on destruction wherever its characters are.
+class SecureString
+    : public std::basic_string<char, std::char_traits<char>,
+                               SecureAllocator<char>> {
+public:
+  typedef std::basic_string<char, std::char_traits<char>,
+                            SecureAllocator<char>>
+      Base;
+  using Base::Base;
+
+  SecureString() = default;
+  SecureString(const SecureString &) = default;
+  SecureString(SecureString &&) = default;
+  SecureString(const Base &other) : Base(other) {}
+  SecureString(std::string_view s) : Base(s.data(), s.size()) {}
+  ~SecureString();
+
+  using Base::operator=;
+  SecureString &operator=(const SecureString &) = default;
+  SecureString &operator=(SecureString &&) = default;
+};
+
+// Secrets in bulk. Short strings live inside the elements, so the elements
+// are kept in the arena as well.
+typedef std::vector<SecureString, SecureAllocator<SecureString>> SecureStrings;
+
+#endif /* __SECURE_H__ */
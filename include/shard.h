@@ -0,0 +1,236 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include "password.h"
+#include "utils.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A shard is one indexed file plus its change log. An unsharded vault is a
+// single shard stored at the vault path; see vault.h for sharded vaults.
+//
+// On-disk layout of a shard file (integers in native byte order):
+//
+//   VaultHeader | records | IndexSlot[indexSlots] | bloom bits | name order
+//
+// Records are variable-length and length-prefixed (see
+// PasswordEntry::Serialize). Version 4 files store them compressed instead:
+//
+//   VaultHeader | BlockRef[blockCount + 1] | zlib blocks | index ...
+//
+// Each block holds whole records, about blockSize bytes of them, and is
+// inflated on its own, so a lookup inflates one block. Offsets in the index
+// and the name order refer to the records before compression either way.
+//
+// The index is an open-addressing hash table over the entry names, so a
+// lookup touches one or two slots and a single record of the mapped file.
+// The bloom filter answers most lookups for missing names without probing
+// the index. The name order lists the record offsets sorted by name, for
+// prefix lookups and listing names without decoding records.
+//
+// Version 2 files lack the name order. Version 1 files hold fixed 192-byte
+// records and files written before the header existed are a bare array of
+// them. All of them are still readable (older ones by scanning) and are
+// converted on the first write.
+//
+// The file is only rewritten by Compact. Adds and deletes are appended to the
+// log next to it (same name, .log extension) as checksummed frames, one frame
+// per Commit:
+//
+//   "EPML" | version | (LogFrame | op byte + record ...)...
+//
+// A delete is stored as a tombstone record. On open the log is replayed over
+// the indexed file; a frame cut short by a crash fails its checksum and is
+// discarded together with everything after it.
+struct VaultHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+  uint64_t recordsOffset;
+  uint64_t indexOffset;
+  uint64_t indexSlots;
+  uint64_t bloomOffset;
+  uint64_t bloomBits;
+  uint32_t bloomHashes;
+  uint32_t keyId; // PasswordManager::KeyFingerprint of the key, 0 if unknown
+  uint64_t namesOffset; // version 3 and later
+  uint64_t rawSize;     // version 4: bytes of records before compression
+  uint64_t blockCount;  // version 4: number of compressed blocks
+  uint32_t blockSize;   // version 4: bytes of records per block, roughly
+  int32_t level;        // version 4: zlib level the blocks were written with
+};
+
+// Where a compressed block starts, before and after compression. A final
+// entry holds rawSize and the end of the last block.
+struct BlockRef {
+  uint64_t rawOffset;
+  uint64_t fileOffset;
+};
+
+// How ShardBuilder stores records. Level 0 writes them as they are; levels
+// 1 to 9 compress blocks of about blockSize bytes with zlib at that level.
+struct Compression {
+  int level = 0;
+  uint32_t blockSize = 16 * 1024;
+};
+
+// Upper 24 bits: upper bits of the name hash. Lower 40 bits: offset of the
+// record from recordsOffset plus one; 0 marks an empty slot.
+typedef uint64_t IndexSlot;
+
+struct LogFrame {
+  uint32_t size;     // bytes of records that follow
+  uint32_t checksum; // FNV-1a of those bytes
+};
+
+enum LogOp : uint8_t { LOG_PUT = 1, LOG_DELETE = 2 };
+
+struct LogRecord {
+  uint8_t op;
+  PasswordEntry entry; // only the name is set for LOG_DELETE
+};
+
+// Serializes a set of entries into a shard file.
+class ShardBuilder {
+public:
+  explicit ShardBuilder(const Compression &compression = Compression());
+
+  // Entries without a name or password are skipped.
+  void Add(const EntryView &entry);
+
+  // The complete file, with keyId recorded in the header.
+  std::string Finish(uint32_t keyId);
+
+private:
+  Compression compression;
+  std::string data;
+  std::vector<std::pair<uint64_t, uint64_t>> placed; // name hash, offset
+
+  std::string compressRecords(VaultHeader &hdr) const;
+};
+
+class Shard {
+public:
+  Shard() = default;
+
+  Shard(const Shard &) = delete;
+  Shard &operator=(const Shard &) = delete;
+
+  // Map the shard at path and replay its log. A missing file is an empty
+  // shard. Throws std::runtime_error if the file is not a valid shard.
+  void Open(const fs::path &path);
+
+  // Returns the entry with the given name, if any. The view points into the
+  // mapped file, an inflated block or the log overlay and is never copied.
+  // Inflated blocks are kept until the shard is reopened.
+  std::optional<EntryView> Find(const std::string &name) const;
+
+  // Add or replace an entry. Changes are kept in memory until Commit.
+  void Put(const PasswordEntry &entry);
+
+  // Remove the entry with the given name. Returns false if there is none.
+  bool Remove(const std::string &name);
+
+  // Call fn for every live entry, read in place.
+  void ForEach(const std::function<void(const EntryView &)> &fn) const;
+
+  // Call fn for every record of the indexed file, leaving out the log.
+  void ForEachIndexed(const std::function<void(const EntryView &)> &fn) const;
+
+  // Call fn for every name the log or staged changes override, with its
+  // entry, or nullptr if it was removed.
+  void ForEachLogged(
+      const std::function<void(const std::string &, const PasswordEntry *)>
+          &fn) const;
+
+  // Call fn for every live name starting with prefix, in byte order. Uses the
+  // name order when the file has one and never decodes a password.
+  void ForEachName(std::string_view prefix,
+                   const std::function<void(std::string_view)> &fn) const;
+
+  // Append the staged changes to the log as a single frame. Compacts the
+  // vault instead once the log would grow past the garbage threshold, or if
+  // the files on disk still use an older format.
+  void Commit();
+
+  // Rewrite the indexed file from the live entries and drop the log.
+  void Compact();
+
+  // True if another process has committed to or compacted the shard since it
+  // was opened.
+  bool Changed() const;
+
+  const fs::path &Path() const { return path; }
+
+  // Size and modification time of the indexed file as opened; the error
+  // values if there is none. Together they identify the file's contents.
+  uintmax_t IndexedSize() const { return baseSize; }
+  fs::file_time_type IndexedTime() const { return baseTime; }
+
+  // Fingerprint of the key the entries are encrypted with, as recorded in the
+  // file; 0 if unknown. SetKeyId changes what the next Compact records.
+  uint32_t KeyId() const { return keyId; }
+  void SetKeyId(uint32_t id) { keyId = id; }
+
+  // How the file stores its records. SetCompression changes how the next
+  // Compact writes them.
+  const Compression &GetCompression() const { return compression; }
+  void SetCompression(const Compression &c) { compression = c; }
+
+  // Number of records in the log, including staged ones.
+  size_t LogRecords() const { return logRecords + staged.size(); }
+
+  // True if Put or Remove were called since the last Commit.
+  bool Dirty() const { return !staged.empty(); }
+
+  // Hand over the changes staged since the last Commit, in the order they
+  // were made, e.g. to apply them again after reopening.
+  std::vector<LogRecord> TakeStaged();
+
+private:
+  fs::path path;
+  fs::path logPath;
+  MappedFile file;
+  const VaultHeader *header = nullptr;
+  uint32_t version = 0;
+  const char *records = nullptr;
+  const char *recordsEnd = nullptr;
+  const uint64_t *names = nullptr;
+  const BlockRef *blocks = nullptr; // version 4
+  uint64_t rawSize = 0;             // bytes of records before compression
+  size_t count = 0;
+  uint32_t keyId = 0;
+  Compression compression;
+  mutable std::vector<std::string> inflated; // by block, empty until read
+
+  // State replayed from the log plus staged changes, shadowing the indexed
+  // file. An empty optional marks a removed name.
+  std::unordered_map<std::string, std::optional<PasswordEntry>> overlay;
+  std::vector<LogRecord> staged;
+  uint64_t logSize = 0;
+  size_t logRecords = 0;
+  uint32_t logVersion = 0;
+
+  // What the files looked like when we last opened or wrote them.
+  fs::file_time_type baseTime;
+  uintmax_t baseSize = 0;
+  uintmax_t logFileSize = 0;
+
+  void openBase();
+  void replayLog();
+  bool needsCompaction(size_t records) const;
+  bool lookup(const std::string &name, EntryView &entry) const;
+  bool scan(const std::function<bool(const EntryView &)> &fn) const;
+  bool bloomContains(uint64_t hash) const;
+  std::string_view nameAt(uint64_t offset) const;
+  const char *recordAt(uint64_t offset, const char *&end) const;
+  const std::string &inflate(size_t block) const;
+};
+
+#endif /* __SHARD_H__ */
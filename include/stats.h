@@ -0,0 +1,84 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <chrono>
+#include <cstdint>
+
+// Phase timers and counters for finding out where a command spends its time.
+// Enabled with --stats[=json] on the command line or EPM_TRACE=1|text|json in
+// the environment; the report is written to stderr when the process exits.
+// While disabled, every hook is a single branch on a global flag.
+namespace stats {
+
+// Phases may nest (a commit that compacts is timed as both), and a phase run
+// by worker threads adds up the time of every thread.
+enum Phase {
+  PHASE_PROMPT,      // waiting for the master password
+  PHASE_READ_KEY,    // reading and parsing epm.key
+  PHASE_CRYPTO_INIT, // setting up OpenSSL and libsodium, once per process
+  PHASE_KDF,         // Argon2 in GenerateKey/VerifyKey
+  PHASE_OPEN,        // mapping a vault file and replaying its log
+  PHASE_DECRYPT,
+  PHASE_ENCRYPT,
+  PHASE_COMMIT,
+  PHASE_COMPACT,
+  PHASE_COUNT
+};
+
+enum Counter {
+  BYTES_READ,
+  BYTES_WRITTEN,
+  ENTRIES_DECODED, // records read from a vault file or log
+  CIPHER_CALLS,    // entries encrypted or decrypted
+  ALLOCATIONS,     // calls to operator new
+  COUNTER_COUNT
+};
+
+enum class Format { Text, Json };
+
+extern bool enabled;
+
+// Start collecting and report in format at exit.
+void enable(Format format);
+
+// Enable from EPM_TRACE if it is set to 1, text or json.
+void enableFromEnvironment();
+
+void record(Counter counter, uint64_t n);
+void record(Phase phase, uint64_t ns);
+
+inline void add(Counter counter, uint64_t n = 1) {
+  if (enabled) {
+    record(counter, n);
+  }
+}
+
+// Adds the lifetime of the timer to phase.
+class Timer {
+public:
+  explicit Timer(Phase phase) : phase(phase), active(enabled) {
+    if (active) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~Timer() {
+    if (active) {
+      record(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+    }
+  }
+
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+private:
+  Phase phase;
+  bool active;
+  std::chrono::steady_clock::time_point start;
+};
+
+} // namespace stats
+
+#endif /* __STATS_H__ */
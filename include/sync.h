@@ -0,0 +1,71 @@
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include "digest.h"
+#include "encryption.h"
+#include "vault.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// Two-way sync of vaults encrypted with the same key.
+//
+// The vaults are compared bucket by bucket (see digest.h) and only the
+// entries of differing buckets are listed, copied or removed, so two large
+// vaults that differ in a few entries are reconciled by reading and writing
+// a few buckets' worth of data.
+//
+// After a sync the bucket digests both vaults agree on are kept next to the
+// local vault, one state file per other vault. Next time, a bucket that only
+// one side changed since is taken from that side, deletions included. Where
+// both changed a bucket, or on the first sync, an entry missing on one side
+// is copied to it and an entry that differs is a conflict unless both hold
+// the same password. An empty vault that was created again since the last
+// sync is synced as on a first sync; one emptied by deleting its entries
+// empties the other.
+struct SyncConflict {
+  std::string_view name;
+  // PasswordManager::SealedTime of each version, checked by opening it.
+  uint64_t localTime;
+  uint64_t otherTime;
+  Digest localDigest;
+  Digest otherDigest;
+};
+
+enum class SyncChoice { Local, Other, Skip };
+
+typedef std::function<SyncChoice(const SyncConflict &)> ConflictResolver;
+
+// Keeps the version sealed last. Ties, such as two entries from before
+// entries carried a time, go the same way whichever side runs the sync.
+SyncChoice lastWriterWins(const SyncConflict &conflict);
+
+struct SyncReport {
+  size_t bucketsDiffering = 0;
+  size_t entriesCompared = 0;
+  size_t copiedToLocal = 0;
+  size_t copiedToOther = 0;
+  size_t removedFromLocal = 0;
+  size_t removedFromOther = 0;
+  size_t conflicts = 0; // settled by the resolver
+  size_t skipped = 0;   // left for the next sync
+};
+
+// File next to the vault at local that holds its sync state with the vault
+// at other.
+fs::path syncStatePath(const fs::path &local, const fs::path &other);
+
+// Make local and other hold the same entries and commit both. Both vaults are
+// locked for writing meanwhile. A vault that records another key than pm's
+// is refused, and every entry copied is opened with pm first; those from
+// other must be sealed, so that they authenticate. Nothing is written if
+// either check fails. A vault that does not record pm's key yet is compacted
+// to record it. Throws std::runtime_error on such a mismatch and on I/O
+// errors.
+SyncReport syncVaults(Vault &local, Vault &other, PasswordManager &pm,
+                      const fs::path &statePath,
+                      const ConflictResolver &resolve);
+
+#endif /* __SYNC_H__ */
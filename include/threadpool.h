@@ -0,0 +1,52 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops over the vault.
+class ThreadPool {
+public:
+  // Start the given number of workers; 0 uses one per hardware thread.
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Number of threads that run a ParallelFor, including the caller.
+  size_t Size() const { return workers.size() + 1; }
+
+  // Split [0, count) into ranges of at most grain items and call
+  // fn(begin, end) for each range on the workers and the calling thread.
+  // Blocks until every range is done and rethrows the first exception.
+  void ParallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t)> &fn);
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  bool stopping = false;
+
+  // The loop currently being run. A new generation wakes the workers.
+  const std::function<void(size_t, size_t)> *job = nullptr;
+  size_t jobCount = 0;
+  size_t jobGrain = 1;
+  std::atomic<size_t> next{0};
+  size_t active = 0;
+  uint64_t generation = 0;
+  std::exception_ptr error;
+
+  void workerLoop();
+  void runRanges();
+};
+
+#endif /* __THREADPOOL_H__ */
@@ -1,12 +1,90 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <cstdint>
 #include <filesystem>
 #include <iostream>
+#include <string>
+#include <string_view>
 
 namespace fs = std::filesystem;
 
+// Name of the vault file in the configuration directory.
+#define VAULT_FILE "epm.bin"
+
+// Path of epm.bin in the platform's configuration directory. Empty if the
+// variable that locates it (HOME, or APPDATA on Windows) is not set.
 fs::path getPlatformPath();
 void makeDirs(const fs::path &path);
 
+// Write data to a temporary file next to path, flush it to disk and rename it
+// over path. Readers that still map the old file keep a consistent view.
+void writeFileAtomic(const fs::path &path, std::string_view data);
+
+// Write data at offset in path, dropping anything already stored past that
+// offset, and flush it to disk. Creates the file if needed.
+void writeFileAt(const fs::path &path, uint64_t offset, const std::string &data);
+
+// Create path, or truncate it if it exists, so that only its owner can read
+// or write it, an existing file included. Throws std::runtime_error on
+// failure.
+void createPrivateFile(const fs::path &path);
+
+// Read-only view of a whole file. Uses mmap where available and falls back to
+// reading the file into memory.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Map the file at path. Returns false if the file does not exist.
+  bool Open(const fs::path &path);
+  void Close();
+
+  const char *Data() const { return data; }
+  size_t Size() const { return size; }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+  std::string buffer;
+#endif
+};
+
+// Advisory lock on a small file shared by all processes using a vault. Any
+// number of shared holders or one exclusive holder; locks are released when
+// the file is closed, also if the process dies. The file also stores a
+// counter that exclusive holders bump to tell others the vault has changed.
+// Locking is a no-op on Windows.
+class LockFile {
+public:
+  LockFile() = default;
+  ~LockFile();
+
+  LockFile(const LockFile &) = delete;
+  LockFile &operator=(const LockFile &) = delete;
+
+  // Open the lock file at path, creating it if possible. Returns false if it
+  // neither exists nor can be created; such a lock is never taken.
+  bool Open(const fs::path &path);
+  void Close();
+  bool IsOpen() const;
+
+  // Block until the lock is held. Returns false if the file is not open.
+  bool Lock(bool exclusive);
+  void Unlock();
+
+  uint64_t ReadCounter() const;
+  void WriteCounter(uint64_t counter);
+
+private:
+#if !defined(_WIN32) && !defined(_WIN64)
+  int fd = -1;
+#endif
+};
+
 #endif /* __UTILS_H__ */
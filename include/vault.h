@@ -0,0 +1,146 @@
+#ifndef __VAULT_H__
+#define __VAULT_H__
+
+#include "shard.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A vault is either a single shard stored at the vault path (the default, and
+// the only layout older releases know), or a manifest at that path naming
+// shardCount shard files next to it:
+//
+//   epm.bin            VaultManifest
+//   epm-<gen>-<i>.bin  shard i of generation gen, with epm-<gen>-<i>.log
+//
+// Entries are spread over the shards by a hash of their name. Shards are only
+// mapped when a command touches them, and a commit appends to (or compacts)
+// just the shards it changed, so per-command cost follows shard size rather
+// than vault size. Writers of different shards never touch the same file.
+//
+// Each shard commits its own frame; a commit that spans shards is atomic per
+// shard. Changing the shard count or the key writes a new generation of shard
+// files and switches to it by replacing the manifest, which is atomic.
+//
+// Processes sharing a vault coordinate through epm.lock next to it. Readers
+// hold it shared only while mapping files, so they never wait for each
+// other. Writers hold it exclusively only while committing or compacting.
+// The lock file carries a commit counter: a writer that finds it moved since
+// the vault was opened reloads the vault and stages its changes again on top,
+// so concurrent writers never lose each other's updates.
+struct VaultManifest {
+  char magic[4];
+  uint32_t version;
+  uint64_t generation;
+  uint32_t shardCount;
+  uint32_t keyId; // PasswordManager::KeyFingerprint of the key, 0 if unknown
+};
+
+class Vault {
+public:
+  Vault() = default;
+
+  Vault(const Vault &) = delete;
+  Vault &operator=(const Vault &) = delete;
+
+  // Open the vault at path. Shards are mapped and their logs replayed on
+  // first use. A missing file is an empty vault. Throws std::runtime_error if
+  // the manifest or a shard is not valid.
+  void Open(const fs::path &path);
+
+  // Returns the entry with the given name, if any. The view is valid until
+  // the vault is changed, compacted or reopened.
+  std::optional<EntryView> Find(const std::string &name) const;
+
+  // Add or replace an entry. Changes are kept in memory until Commit.
+  void Put(const PasswordEntry &entry);
+
+  // Remove the entry with the given name. Returns false if there is none.
+  bool Remove(const std::string &name);
+
+  // Call fn for every live entry, shard by shard, without copying it.
+  void ForEach(const std::function<void(const EntryView &)> &fn) const;
+
+  // Call fn for every live name starting with prefix, in byte order across
+  // all shards. Never decodes a password.
+  void ForEachName(std::string_view prefix,
+                   const std::function<void(std::string_view)> &fn) const;
+
+  // Commit the staged changes of every shard that has any.
+  void Commit();
+
+  // Rewrite the vault from the live entries and drop all logs. A non-zero
+  // shardCount changes the number of shards; 1 stores the vault as a single
+  // file again. compression changes how the shards store their records;
+  // without it they keep what the first shard uses.
+  void Compact(size_t shardCount = 0,
+               std::optional<Compression> compression = std::nullopt);
+
+  // True if another process has committed to or compacted the vault since it
+  // was opened.
+  bool Changed() const;
+
+  // The cheap part of Changed(): true if a process that holds the lock has
+  // committed or compacted since. Reads one counter and stats no file.
+  bool CounterChanged() const;
+
+  // The lock file's commit counter as of the last load or commit. It only
+  // grows, so a smaller value than seen before means the vault was created
+  // again.
+  uint64_t Commits() const { return commits; }
+
+  const fs::path &Path() const { return path; }
+
+  size_t ShardCount() const { return shardCount; }
+
+  // Shard index, mapped and its log replayed on first use.
+  const Shard &GetShard(size_t index) const { return shard(index); }
+
+  // Number of log records across the shards opened so far.
+  size_t LogRecords() const;
+
+  // Fingerprint of the key the entries are encrypted with, as recorded in the
+  // vault; 0 if unknown. SetKeyId changes what the next Compact records.
+  uint32_t KeyId() const;
+  void SetKeyId(uint32_t id) { newKeyId = id; }
+
+  // Hold the write lock until a matching Unlock, e.g. across a rewrite of
+  // the whole vault that must not interleave with other writers. Reloads the
+  // vault first if another process changed it. Commit and Compact take it
+  // themselves when it is not held. Throws std::runtime_error if the lock
+  // file cannot be created.
+  void LockExclusive();
+  void Unlock();
+
+private:
+  fs::path path;
+  bool sharded = false;
+  uint64_t generation = 0;
+  size_t shardCount = 1;
+  uint32_t diskKeyId = 0;            // from the manifest or the only shard
+  std::optional<uint32_t> newKeyId; // set by SetKeyId
+  mutable std::vector<std::unique_ptr<Shard>> shards;
+
+  fs::file_time_type manifestTime;
+  uintmax_t manifestSize = 0;
+
+  mutable LockFile lock;
+  int lockDepth = 0;
+  uint64_t commits = 0; // lock file counter when the vault was loaded
+
+  void load();
+  void reload();
+  void compact(size_t shardCount, std::optional<Compression> compression);
+  void bumpCommits();
+  fs::path shardPath(uint64_t generation, size_t index) const;
+  Shard &shard(size_t index) const;
+  void removeShards(uint64_t generation, size_t count) const;
+};
+
+#endif /* __VAULT_H__ */
@@ -0,0 +1,314 @@
+#include "agent.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#define AGENT_MAX_REQUEST (1 << 20)
+#define AGENT_IO_TIMEOUT 5 // seconds a client may take to send its request
+
+Agent::Agent(Vault &vault, PasswordManager &pm, const fs::path &socketPath)
+    : vault(vault), pm(pm), socketPath(socketPath), vaultPath(vault.Path()) {}
+
+bool Agent::handle(const std::vector<SecureString> &request,
+                   SecureString &reply) {
+  const SecureString &command = request[0];
+
+  // Pick up commits and compactions made by other processes.
+  if (vault.Changed()) {
+    vault.Open(vaultPath);
+  }
+
+  if (command == "get" && request.size() == 2) {
+    std::optional<EntryView> entry = vault.Find(std::string(request[1]));
+    if (!entry) {
+      reply = AGENT_NOT_FOUND;
+      return true;
+    }
+    reply = AGENT_OK;
+    // Entries still encrypted with the legacy cipher are sealed again.
+    bool legacy = false;
+    std::string sealed;
+    pm.withPlaintext(
+        entry->GetPassword(),
+        [this, &legacy, &reply, &sealed](std::string_view password) {
+          reply += password;
+          if (legacy) {
+            sealed = pm.encrypt(password);
+          }
+        },
+        nullptr, &legacy);
+    if (legacy) {
+      vault.Put(PasswordEntry(std::string(request[1]), sealed));
+      vault.Commit();
+    }
+  } else if (command == "list" && request.size() == 1) {
+    reply = AGENT_OK;
+    vault.ForEach([&reply](const EntryView &entry) {
+      reply += entry.GetName();
+      reply += '\0';
+    });
+  } else if (command == "add" && request.size() == 3) {
+    std::string name(request[1]);
+    if (name.empty() || name.size() > ENTRY_MAX_NAME || request[2].empty() ||
+        request[2].size() > ENTRY_MAX_SECRET) {
+      reply = AGENT_ERROR;
+      reply += "name or password is empty or too long";
+      return true;
+    }
+    vault.Put(PasswordEntry(name, pm.encrypt(request[2])));
+    vault.Commit();
+    reply = AGENT_OK;
+  } else if (command == "ping" && request.size() == 1) {
+    reply = AGENT_OK;
+  } else if (command == "lock" && request.size() == 1) {
+    reply = AGENT_OK;
+    return false;
+  } else {
+    reply = AGENT_ERROR;
+    reply += "unknown request '" + command + "'";
+  }
+  return true;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+void Agent::Serve(unsigned) {
+  throw std::runtime_error("the agent is not supported on this platform");
+}
+
+bool agentRequest(const fs::path &, const std::vector<std::string> &,
+                  SecureString &) {
+  return false;
+}
+
+#else
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int) { interrupted = 1; }
+
+static bool socketAddress(const fs::path &path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  const std::string &str = path.native();
+  if (str.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memcpy(addr.sun_path, str.c_str(), str.size() + 1);
+  return true;
+}
+
+static bool readAll(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool writeAll(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool readFrame(int fd, SecureString &frame, uint32_t maxSize) {
+  uint32_t size;
+  if (!readAll(fd, reinterpret_cast<char *>(&size), sizeof(size)) ||
+      size > maxSize) {
+    return false;
+  }
+  frame.resize(size);
+  return readAll(fd, &frame[0], size);
+}
+
+static bool writeFrame(int fd, std::string_view frame) {
+  uint32_t size = frame.size();
+  return writeAll(fd, reinterpret_cast<const char *>(&size), sizeof(size)) &&
+         writeAll(fd, frame.data(), frame.size());
+}
+
+static std::vector<SecureString> splitFields(const SecureString &frame) {
+  std::vector<SecureString> fields(1);
+  for (char c : frame) {
+    if (c == '\0') {
+      fields.emplace_back();
+    } else {
+      fields.back() += c;
+    }
+  }
+  return fields;
+}
+
+// Only the user that started the agent may talk to it.
+static bool peerIsOwner(int fd) {
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+    return false;
+  }
+  return cred.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+void Agent::Serve(unsigned idleSeconds) {
+  sockaddr_un addr;
+  if (!socketAddress(socketPath, addr)) {
+    throw std::runtime_error("socket path " + socketPath.string() +
+                             " is too long");
+  }
+
+  // Refuse to start twice; clear out a socket left by an agent that died.
+  SecureString reply;
+  if (agentRequest(socketPath, {"ping"}, reply)) {
+    throw std::runtime_error("an agent is already running on " +
+                             socketPath.string());
+  }
+  unlink(socketPath.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    throw std::runtime_error(std::string("unable to create socket: ") +
+                             strerror(errno));
+  }
+
+  mode_t mask = umask(0077);
+  int rc = bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  umask(mask);
+  if (rc != 0 || listen(listener, 64) != 0) {
+    int err = errno;
+    close(listener);
+    throw std::runtime_error("unable to listen on " + socketPath.string() +
+                             ": " + strerror(err));
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  sigaction(SIGHUP, &action, nullptr);
+
+  using Clock = std::chrono::steady_clock;
+  const std::chrono::seconds idle(idleSeconds);
+  Clock::time_point idleUntil = Clock::now() + idle;
+
+  bool running = true;
+  while (running && !interrupted) {
+    // poll() takes an int of milliseconds, so long timeouts are waited out in
+    // steps.
+    int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       idleUntil - Clock::now())
+                       .count();
+    if (left <= 0) {
+      break; // idle timeout
+    }
+    pollfd pfd{listener, POLLIN, 0};
+    int ready =
+        poll(&pfd, 1, static_cast<int>(std::min<int64_t>(left, INT_MAX)));
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (ready == 0) {
+      continue;
+    }
+
+    int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      continue;
+    }
+
+    timeval timeout{AGENT_IO_TIMEOUT, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Everything the request leaves in the arena is wiped in one go.
+    SecureArena::Scope scope;
+    SecureString frame;
+    if (peerIsOwner(client) &&
+        readFrame(client, frame, AGENT_MAX_REQUEST)) {
+      std::vector<SecureString> request = splitFields(frame);
+      SecureString reply;
+      try {
+        running = handle(request, reply);
+      } catch (const std::exception &e) {
+        reply = AGENT_ERROR;
+        reply += e.what();
+      }
+      writeFrame(client, reply);
+    }
+    close(client);
+    idleUntil = Clock::now() + idle;
+  }
+
+  close(listener);
+  unlink(socketPath.c_str());
+  pm.wipeSecret();
+}
+
+bool agentRequest(const fs::path &socketPath,
+                  const std::vector<std::string> &request,
+                  SecureString &reply) {
+  sockaddr_un addr;
+  if (!socketAddress(socketPath, addr)) {
+    return false;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  SecureString frame;
+  for (size_t i = 0; i < request.size(); ++i) {
+    if (i > 0) {
+      frame += '\0';
+    }
+    frame += request[i];
+  }
+
+  bool ok = writeFrame(fd, frame) && readFrame(fd, reply, UINT32_MAX) &&
+            !reply.empty();
+  close(fd);
+  return ok;
+}
+#endif
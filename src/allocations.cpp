@@ -0,0 +1,26 @@
+#include "stats.h"
+
+#include <cstdlib>
+#include <new>
+
+// Count allocations for --stats. The replacement only adds the branch on
+// stats::enabled to what the default operator new does. It is linked into
+// the executables only, as libepm must not replace operator new in the
+// processes that load it.
+void *operator new(size_t size) {
+  stats::add(stats::ALLOCATIONS);
+  for (;;) {
+    if (void *p = std::malloc(size ? size : 1)) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
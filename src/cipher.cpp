@@ -0,0 +1,260 @@
+#include "cipher.h"
+#include "stats.h"
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <openssl/evp.h>
+#include <sodium.h>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define GCM_NONCE_SIZE 12
+#define GCM_TAG_SIZE 16
+// Seals per engine when picking the fastest, on messages the size of a
+// typical password.
+#define CALIBRATION_ROUNDS 2000
+#define CALIBRATION_MESSAGE 32
+// Random bytes fetched at once for nonces. A call into the system's random
+// source costs more than sealing a password, so it is made once per pool.
+#define NONCE_POOL_SIZE 4096
+
+// Fill nonce with random bytes from a per-thread pool. The pool is wiped as
+// it is used and never shared with another thread. A process embedding
+// libepm may fork, and the child inherits the rest of the pool, so a pool
+// drawn by another process is thrown away rather than reused.
+static void randomNonce(unsigned char *nonce, size_t size) {
+  static thread_local unsigned char pool[NONCE_POOL_SIZE];
+  static thread_local size_t available = 0;
+  static thread_local auto owner = getpid();
+  if (owner != getpid()) {
+    sodium_memzero(pool, sizeof(pool));
+    available = 0;
+    owner = getpid();
+  }
+  if (available < size) {
+    randombytes_buf(pool, sizeof(pool));
+    available = sizeof(pool);
+  }
+  unsigned char *bytes = pool + sizeof(pool) - available;
+  memcpy(nonce, bytes, size);
+  sodium_memzero(bytes, size);
+  available -= size;
+}
+
+void cryptoInit() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    stats::Timer timer(stats::PHASE_CRYPTO_INIT);
+    // Error strings, algorithm tables and an early RAND_poll are not needed:
+    // ciphers are fetched by name and the DRBG seeds itself on first use.
+    OPENSSL_init_crypto(0, NULL);
+    if (sodium_init() < 0) {
+      throw std::runtime_error("Sodium initialization failed.");
+    }
+  });
+}
+
+// AES-256-GCM fetched from the default provider once, rather than looked up
+// again by every context that is keyed with it.
+static const EVP_CIPHER *aes256Gcm() {
+  static const EVP_CIPHER *aes = EVP_CIPHER_fetch(NULL, "AES-256-GCM", NULL);
+  if (aes == nullptr) {
+    throw std::runtime_error("AES-256-GCM is not available");
+  }
+  return aes;
+}
+
+// One direction of AES-256-GCM owned by a thread. The key schedule is only
+// set up again when a call brings another key.
+struct GcmContext {
+  EVP_CIPHER_CTX *ctx = nullptr;
+  unsigned char key[CIPHER_KEY_SIZE];
+  bool keyed = false;
+
+  ~GcmContext() {
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(key, sizeof(key));
+  }
+};
+
+static thread_local GcmContext sealContext;
+static thread_local GcmContext openContext;
+
+static EVP_CIPHER_CTX *gcmContextFor(const uint8_t *key, bool seal) {
+  GcmContext &c = seal ? sealContext : openContext;
+  if (c.ctx == nullptr) {
+    cryptoInit();
+    c.ctx = EVP_CIPHER_CTX_new();
+    if (c.ctx == nullptr) {
+      throw std::runtime_error("unable to allocate cipher context");
+    }
+  }
+  if (!c.keyed || CRYPTO_memcmp(c.key, key, CIPHER_KEY_SIZE) != 0) {
+    int ok = seal ? EVP_EncryptInit_ex(c.ctx, aes256Gcm(), NULL, key, NULL)
+                  : EVP_DecryptInit_ex(c.ctx, aes256Gcm(), NULL, key, NULL);
+    if (ok != 1) {
+      throw std::runtime_error("unable to set up AES-256-GCM");
+    }
+    memcpy(c.key, key, CIPHER_KEY_SIZE);
+    c.keyed = true;
+  }
+  return c.ctx;
+}
+
+// Output: nonce | ciphertext | tag.
+class AesGcmEngine : public CipherEngine {
+public:
+  CipherId Id() const override { return CIPHER_AES_256_GCM; }
+  const char *Name() const override { return "aes256gcm"; }
+  size_t Overhead() const override { return GCM_NONCE_SIZE + GCM_TAG_SIZE; }
+
+  void Seal(const uint8_t *key, std::string_view ad, std::string_view plaintext,
+            char *out) const override {
+    EVP_CIPHER_CTX *ctx = gcmContextFor(key, true);
+    auto *nonce = reinterpret_cast<unsigned char *>(out);
+    auto *body = nonce + GCM_NONCE_SIZE;
+    randomNonce(nonce, GCM_NONCE_SIZE);
+
+    int len;
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, NULL, &len,
+                          reinterpret_cast<const unsigned char *>(ad.data()),
+                          ad.size()) != 1 ||
+        EVP_EncryptUpdate(
+            ctx, body, &len,
+            reinterpret_cast<const unsigned char *>(plaintext.data()),
+            plaintext.size()) != 1 ||
+        EVP_EncryptFinal_ex(ctx, body + len, &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_SIZE,
+                            body + plaintext.size()) != 1) {
+      throw std::runtime_error("AES-256-GCM encryption failed");
+    }
+  }
+
+  bool Open(const uint8_t *key, std::string_view ad, std::string_view sealed,
+            char *out, size_t &length) const override {
+    if (sealed.size() < Overhead()) {
+      return false;
+    }
+    EVP_CIPHER_CTX *ctx = gcmContextFor(key, false);
+    auto *nonce = reinterpret_cast<const unsigned char *>(sealed.data());
+    const unsigned char *body = nonce + GCM_NONCE_SIZE;
+    size_t bodySize = sealed.size() - Overhead();
+    auto *plaintext = reinterpret_cast<unsigned char *>(out);
+
+    int len;
+    int final;
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &len,
+                          reinterpret_cast<const unsigned char *>(ad.data()),
+                          ad.size()) != 1 ||
+        EVP_DecryptUpdate(ctx, plaintext, &len, body, bodySize) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_SIZE,
+                            const_cast<unsigned char *>(body + bodySize)) != 1 ||
+        EVP_DecryptFinal_ex(ctx, plaintext + len, &final) != 1) {
+      return false;
+    }
+    length = len + final;
+    return true;
+  }
+};
+
+// Output: nonce | ciphertext and tag, as libsodium writes them.
+class XChaChaEngine : public CipherEngine {
+public:
+  CipherId Id() const override { return CIPHER_XCHACHA20_POLY1305; }
+  const char *Name() const override { return "xchacha20poly1305"; }
+  size_t Overhead() const override {
+    return crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
+           crypto_aead_xchacha20poly1305_ietf_ABYTES;
+  }
+
+  void Seal(const uint8_t *key, std::string_view ad, std::string_view plaintext,
+            char *out) const override {
+    cryptoInit();
+    auto *nonce = reinterpret_cast<unsigned char *>(out);
+    randomNonce(nonce, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, NULL,
+        reinterpret_cast<const unsigned char *>(plaintext.data()),
+        plaintext.size(), reinterpret_cast<const unsigned char *>(ad.data()),
+        ad.size(), NULL, nonce, key);
+  }
+
+  bool Open(const uint8_t *key, std::string_view ad, std::string_view sealed,
+            char *out, size_t &length) const override {
+    if (sealed.size() < Overhead()) {
+      return false;
+    }
+    cryptoInit();
+    auto *nonce = reinterpret_cast<const unsigned char *>(sealed.data());
+    unsigned long long plaintextSize;
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            reinterpret_cast<unsigned char *>(out), &plaintextSize, NULL,
+            nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+            sealed.size() - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+            reinterpret_cast<const unsigned char *>(ad.data()), ad.size(),
+            nonce, key) != 0) {
+      return false;
+    }
+    length = plaintextSize;
+    return true;
+  }
+};
+
+static const AesGcmEngine aesGcm;
+static const XChaChaEngine xchacha;
+static const CipherEngine *engines[] = {&aesGcm, &xchacha};
+
+const CipherEngine *cipherEngine(uint8_t id) {
+  for (const CipherEngine *engine : engines) {
+    if (engine->Id() == id) {
+      return engine;
+    }
+  }
+  return nullptr;
+}
+
+const CipherEngine *cipherEngineNamed(std::string_view name) {
+  for (const CipherEngine *engine : engines) {
+    if (name == engine->Name()) {
+      return engine;
+    }
+  }
+  return nullptr;
+}
+
+CipherId fastestCipher() {
+  cryptoInit();
+
+  uint8_t key[CIPHER_KEY_SIZE];
+  randombytes_buf(key, sizeof(key));
+  std::string plaintext(CALIBRATION_MESSAGE, 'x');
+  std::string out;
+
+  CipherId best = CIPHER_AES_256_GCM;
+  double bestTime = 0;
+  for (const CipherEngine *engine : engines) {
+    out.resize(engine->Overhead() + plaintext.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALIBRATION_ROUNDS; ++i) {
+      engine->Seal(key, "", plaintext, &out[0]);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (bestTime == 0 || elapsed.count() < bestTime) {
+      best = engine->Id();
+      bestTime = elapsed.count();
+    }
+  }
+  sodium_memzero(key, sizeof(key));
+  return best;
+}
@@ -0,0 +1,483 @@
+#include "codec.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EPM_CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+namespace codec {
+
+static const char BASE64_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char HEX_LOWER[] = "0123456789abcdef";
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+
+// Decode table markers; anything below 64 is a digit value.
+#define B64_INVALID 0xFF
+#define B64_SPACE 0xFE
+#define B64_PAD 0xFD
+#define HEX_INVALID 0xFF
+
+struct Tables {
+  uint8_t base64[256];
+  uint8_t hex[256];
+
+  Tables() {
+    memset(base64, B64_INVALID, sizeof(base64));
+    memset(hex, HEX_INVALID, sizeof(hex));
+    for (int i = 0; i < 64; ++i) {
+      base64[static_cast<uint8_t>(BASE64_ALPHABET[i])] = i;
+    }
+    base64[static_cast<uint8_t>('=')] = B64_PAD;
+    for (const char *c = " \t\r\n"; *c != '\0'; ++c) {
+      base64[static_cast<uint8_t>(*c)] = B64_SPACE;
+    }
+    for (int i = 0; i < 16; ++i) {
+      hex[static_cast<uint8_t>(HEX_LOWER[i])] = i;
+      hex[static_cast<uint8_t>(HEX_UPPER[i])] = i;
+    }
+  }
+};
+
+static const Tables tables;
+
+// Block kernels only handle whole blocks and return how much input they
+// consumed; the scalar code below finishes the tail. Decoders stop early at
+// the first block that is not plain base64/hex so the tail code can skip
+// whitespace or report the error.
+struct Kernels {
+  const char *name;
+  size_t (*base64Encode)(const uint8_t *src, size_t n, char *dst);
+  size_t (*base64Decode)(const char *src, size_t n, uint8_t *dst);
+  size_t (*hexEncode)(const uint8_t *src, size_t n, char *dst,
+                      const char *digits);
+  size_t (*hexDecode)(const char *src, size_t n, uint8_t *dst);
+};
+
+static size_t noBase64Encode(const uint8_t *, size_t, char *) { return 0; }
+static size_t noBase64Decode(const char *, size_t, uint8_t *) { return 0; }
+static size_t noHexEncode(const uint8_t *, size_t, char *, const char *) {
+  return 0;
+}
+static size_t noHexDecode(const char *, size_t, uint8_t *) { return 0; }
+
+#ifdef EPM_CODEC_X86
+
+// Base64 kernels follow Muła and Lemire, "Faster Base64 Encoding and Decoding
+// Using AVX2 Instructions": split 3 bytes into 4 sextets with multiplies,
+// then translate sextets to ASCII (and back) with pshufb range lookups.
+
+__attribute__((target("ssse3"))) static size_t
+ssse3Base64Encode(const uint8_t *src, size_t n, char *dst) {
+  const __m128i spread =
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4,
+                                        -4, -4, -4, -19, -16, 0, 0);
+  size_t i = 0;
+  // Each step reads 16 bytes but only consumes 12.
+  for (; i + 16 <= n; i += 12, dst += 16) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    in = _mm_shuffle_epi8(in, spread);
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i sextets = _mm_or_si128(t1, t3);
+
+    __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+    __m128i lower = _mm_cmpgt_epi8(sextets, _mm_set1_epi8(25));
+    range = _mm_sub_epi8(range, lower);
+    __m128i out = _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), out);
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) static size_t
+ssse3Base64Decode(const char *src, size_t n, uint8_t *dst) {
+  const __m128i lutLo =
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lutHi =
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lutRoll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask2F = _mm_set1_epi8(0x2F);
+  const __m128i pack =
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  // Each step writes 16 bytes but only 12 are output; keeping 8 characters
+  // of input in reserve keeps the overrun inside base64DecodedMaxSize.
+  for (; i + 24 <= n; i += 16, dst += 12) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask2F);
+    __m128i loNibbles = _mm_and_si128(in, mask2F);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128())) != 0) {
+      break;
+    }
+    __m128i eq2F = _mm_cmpeq_epi8(in, mask2F);
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    __m128i sextets = _mm_add_epi8(in, roll);
+
+    __m128i merged =
+        _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(out, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), out);
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) static size_t
+ssse3HexEncode(const uint8_t *src, size_t n, char *dst, const char *digits) {
+  const __m128i lut =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(digits));
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16, dst += 32) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i hi = _mm_shuffle_epi8(
+        lut, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, nibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+                     _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+// Map 16 hex digits to their values; clears valid lanes that are not digits.
+__attribute__((target("ssse3"))) static inline __m128i
+ssse3HexValues(__m128i in, int &valid) {
+  __m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+  __m128i letter =
+      _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+  valid &= _mm_movemask_epi8(_mm_or_si128(digit, letter));
+  __m128i digitValue =
+      _mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0')));
+  __m128i letterValue =
+      _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+  return _mm_or_si128(digitValue, letterValue);
+}
+
+__attribute__((target("ssse3"))) static size_t
+ssse3HexDecode(const char *src, size_t n, uint8_t *dst) {
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32, dst += 16) {
+    int valid = 0xFFFF;
+    __m128i a = ssse3HexValues(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), valid);
+    __m128i b = ssse3HexValues(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 16)),
+        valid);
+    if (valid != 0xFFFF) {
+      break;
+    }
+    __m128i out = _mm_packus_epi16(_mm_maddubs_epi16(a, weights),
+                                   _mm_maddubs_epi16(b, weights));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), out);
+  }
+  return i;
+}
+
+// The AVX2 kernels run the same steps on two 128-bit lanes at once.
+
+__attribute__((target("avx2"))) static size_t
+avx2Base64Encode(const uint8_t *src, size_t n, char *dst) {
+  const __m256i spread = _mm256_broadcastsi128_si256(
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  const __m256i offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+      65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0));
+  size_t i = 0;
+  // Lanes load 12 bytes apart; the upper lane reads up to byte 28.
+  for (; i + 28 <= n; i += 24, dst += 32) {
+    __m256i in = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 12)), 1);
+    in = _mm256_shuffle_epi8(in, spread);
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    __m256i sextets = _mm256_or_si256(t1, t3);
+
+    __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+    __m256i lower = _mm256_cmpgt_epi8(sextets, _mm256_set1_epi8(25));
+    range = _mm256_sub_epi8(range, lower);
+    __m256i out =
+        _mm256_add_epi8(sextets, _mm256_shuffle_epi8(offsets, range));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), out);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2Base64Decode(const char *src, size_t n, uint8_t *dst) {
+  const __m256i lutLo = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A));
+  const __m256i lutHi = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+  const __m256i lutRoll = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+  const __m256i mask2F = _mm256_set1_epi8(0x2F);
+  const __m256i pack = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+  size_t i = 0;
+  // 32 bytes are written per 24 output; see ssse3Base64Decode.
+  for (; i + 48 <= n; i += 32, dst += 24) {
+    __m256i in =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask2F);
+    __m256i loNibbles = _mm256_and_si256(in, mask2F);
+    __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+    __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+    if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(
+            _mm256_and_si256(lo, hi), _mm256_setzero_si256())) != 0) {
+      break;
+    }
+    __m256i eq2F = _mm256_cmpeq_epi8(in, mask2F);
+    __m256i roll =
+        _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+    __m256i sextets = _mm256_add_epi8(in, roll);
+
+    __m256i merged =
+        _mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, pack);
+    out = _mm256_permutevar8x32_epi32(out, join);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), out);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2HexEncode(const uint8_t *src, size_t n, char *dst, const char *digits) {
+  const __m256i lut = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(digits)));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32, dst += 64) {
+    __m256i in =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i hi = _mm256_shuffle_epi8(
+        lut, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(in, nibble));
+    // Unpacking works per lane, so swap the middle halves back in order.
+    __m256i first = _mm256_unpacklo_epi8(hi, lo);
+    __m256i second = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+avx2HexValues(__m256i in, uint32_t &valid) {
+  __m256i lower = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+  __m256i digit =
+      _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+  __m256i letter =
+      _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+  valid &= static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_or_si256(digit, letter)));
+  __m256i digitValue =
+      _mm256_and_si256(digit, _mm256_sub_epi8(in, _mm256_set1_epi8('0')));
+  __m256i letterValue = _mm256_and_si256(
+      letter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)));
+  return _mm256_or_si256(digitValue, letterValue);
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2HexDecode(const char *src, size_t n, uint8_t *dst) {
+  const __m256i weights = _mm256_set1_epi16(0x0110);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64, dst += 32) {
+    uint32_t valid = 0xFFFFFFFF;
+    __m256i a = avx2HexValues(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)), valid);
+    __m256i b = avx2HexValues(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32)),
+        valid);
+    if (valid != 0xFFFFFFFF) {
+      break;
+    }
+    __m256i out = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights),
+                                      _mm256_maddubs_epi16(b, weights));
+    // Packing interleaves the lanes of a and b; restore a0 a1 b0 b1.
+    out = _mm256_permute4x64_epi64(out, 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), out);
+  }
+  return i;
+}
+
+#endif /* EPM_CODEC_X86 */
+
+static const Kernels SCALAR = {"scalar", noBase64Encode, noBase64Decode,
+                               noHexEncode, noHexDecode};
+#ifdef EPM_CODEC_X86
+static const Kernels SSSE3 = {"ssse3", ssse3Base64Encode, ssse3Base64Decode,
+                              ssse3HexEncode, ssse3HexDecode};
+static const Kernels AVX2 = {"avx2", avx2Base64Encode, avx2Base64Decode,
+                             avx2HexEncode, avx2HexDecode};
+#endif
+
+static const Kernels &pickKernels() {
+#ifdef EPM_CODEC_X86
+  __builtin_cpu_init();
+  bool hasAvx2 = __builtin_cpu_supports("avx2");
+  bool hasSsse3 = __builtin_cpu_supports("ssse3");
+
+  // The override can only select kernels the CPU actually runs.
+  const char *forced = getenv("EPM_CODEC");
+  if (forced != nullptr) {
+    if (strcmp(forced, "scalar") == 0) {
+      return SCALAR;
+    }
+    if (strcmp(forced, "ssse3") == 0 && hasSsse3) {
+      return SSSE3;
+    }
+  }
+  if (hasAvx2) {
+    return AVX2;
+  }
+  if (hasSsse3) {
+    return SSSE3;
+  }
+#endif
+  return SCALAR;
+}
+
+static const Kernels &kernels() {
+  static const Kernels &selected = pickKernels();
+  return selected;
+}
+
+const char *kernelName() { return kernels().name; }
+
+size_t base64Encode(const uint8_t *src, size_t n, char *dst) {
+  size_t i = kernels().base64Encode(src, n, dst);
+  char *out = dst + i / 3 * 4;
+
+  for (; i + 3 <= n; i += 3) {
+    uint32_t v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    *out++ = BASE64_ALPHABET[v >> 18];
+    *out++ = BASE64_ALPHABET[(v >> 12) & 0x3F];
+    *out++ = BASE64_ALPHABET[(v >> 6) & 0x3F];
+    *out++ = BASE64_ALPHABET[v & 0x3F];
+  }
+  if (i < n) {
+    uint32_t v = src[i] << 16;
+    if (i + 1 < n) {
+      v |= src[i + 1] << 8;
+    }
+    *out++ = BASE64_ALPHABET[v >> 18];
+    *out++ = BASE64_ALPHABET[(v >> 12) & 0x3F];
+    *out++ = i + 1 < n ? BASE64_ALPHABET[(v >> 6) & 0x3F] : '=';
+    *out++ = '=';
+  }
+  return out - dst;
+}
+
+bool base64Decode(const char *src, size_t n, uint8_t *dst, size_t *written) {
+  size_t i = kernels().base64Decode(src, n, dst);
+  uint8_t *out = dst + i / 4 * 3;
+
+  uint32_t acc = 0;
+  int sextets = 0;
+  int padding = 0;
+  for (; i < n; ++i) {
+    uint8_t v = tables.base64[static_cast<uint8_t>(src[i])];
+    if (v == B64_SPACE) {
+      continue;
+    }
+    if (v == B64_PAD) {
+      ++padding;
+      continue;
+    }
+    if (v == B64_INVALID || padding > 0) {
+      return false;
+    }
+    acc = (acc << 6) | v;
+    if (++sextets == 4) {
+      *out++ = acc >> 16;
+      *out++ = acc >> 8;
+      *out++ = acc;
+      acc = 0;
+      sextets = 0;
+    }
+  }
+
+  // Padding is optional, but when present it must complete the last quantum.
+  switch (sextets) {
+  case 0:
+    if (padding != 0) {
+      return false;
+    }
+    break;
+  case 2:
+    if (padding != 0 && padding != 2) {
+      return false;
+    }
+    *out++ = acc >> 4;
+    break;
+  case 3:
+    if (padding > 1) {
+      return false;
+    }
+    *out++ = acc >> 10;
+    *out++ = acc >> 2;
+    break;
+  default:
+    return false;
+  }
+
+  *written = out - dst;
+  return true;
+}
+
+void hexEncode(const uint8_t *src, size_t n, char *dst, bool upper) {
+  const char *digits = upper ? HEX_UPPER : HEX_LOWER;
+  size_t i = kernels().hexEncode(src, n, dst, digits);
+  for (char *out = dst + 2 * i; i < n; ++i) {
+    *out++ = digits[src[i] >> 4];
+    *out++ = digits[src[i] & 0x0F];
+  }
+}
+
+bool hexDecode(const char *src, size_t n, uint8_t *dst) {
+  if (n % 2 != 0) {
+    return false;
+  }
+  size_t i = kernels().hexDecode(src, n, dst);
+  for (uint8_t *out = dst + i / 2; i < n; i += 2) {
+    uint8_t hi = tables.hex[static_cast<uint8_t>(src[i])];
+    uint8_t lo = tables.hex[static_cast<uint8_t>(src[i + 1])];
+    if (hi == HEX_INVALID || lo == HEX_INVALID) {
+      return false;
+    }
+    *out++ = (hi << 4) | lo;
+  }
+  return true;
+}
+
+} // namespace codec
@@ -0,0 +1,255 @@
+#include "digest.h"
+#include "cipher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sodium.h>
+#include <stdexcept>
+
+#define DIGEST_MAGIC "EPMD"
+#define DIGEST_VERSION 1
+
+static void xorInto(Digest &into, const Digest &digest) {
+  for (size_t i = 0; i < DIGEST_SIZE; ++i) {
+    into[i] ^= digest[i];
+  }
+}
+
+static void hashUpdate(crypto_generichash_state &state,
+                       std::string_view data) {
+  crypto_generichash_update(
+      &state, reinterpret_cast<const unsigned char *>(data.data()),
+      data.size());
+}
+
+Digest entryDigest(const EntryView &entry) {
+  // The name length keeps bytes from moving between name and password
+  // unnoticed.
+  std::string length;
+  putVarint(length, entry.GetName().size());
+
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, NULL, 0, DIGEST_SIZE);
+  hashUpdate(state, length);
+  hashUpdate(state, entry.GetName());
+  hashUpdate(state, entry.GetPassword());
+  Digest digest;
+  crypto_generichash_final(&state, digest.data(), digest.size());
+  return digest;
+}
+
+size_t digestBucket(std::string_view name) {
+  unsigned char hash[crypto_generichash_BYTES_MIN];
+  crypto_generichash(hash, sizeof(hash),
+                     reinterpret_cast<const unsigned char *>(name.data()),
+                     name.size(), NULL, 0);
+  // Byte by byte, so that every host puts a name in the same bucket.
+  return (size_t(hash[0]) | size_t(hash[1]) << 8) % DIGEST_BUCKETS;
+}
+
+// Offsets of the parts of a .sum file.
+#define DIGEST_STARTS_OFFSET sizeof(DigestFileHeader)
+#define DIGEST_BUCKETS_OFFSET                                                  \
+  (DIGEST_STARTS_OFFSET + (DIGEST_BUCKETS + 1) * sizeof(uint64_t))
+#define DIGEST_ENTRIES_OFFSET                                                  \
+  (DIGEST_BUCKETS_OFFSET + DIGEST_BUCKETS * sizeof(Digest))
+
+static int64_t timeStamp(fs::file_time_type time) {
+  return time.time_since_epoch().count();
+}
+
+// The .sum file of the indexed file of shard.
+static std::string buildSums(const Shard &shard) {
+  std::vector<std::vector<DigestedEntry>> byBucket(DIGEST_BUCKETS);
+  uint64_t count = 0;
+  shard.ForEachIndexed([&byBucket, &count](const EntryView &entry) {
+    byBucket[digestBucket(entry.GetName())].push_back(
+        DigestedEntry{entry.GetName(), entryDigest(entry)});
+    ++count;
+  });
+
+  DigestFileHeader hdr{};
+  memcpy(hdr.magic, DIGEST_MAGIC, 4);
+  hdr.version = DIGEST_VERSION;
+  hdr.buckets = DIGEST_BUCKETS;
+  hdr.count = count;
+  hdr.indexedSize = shard.IndexedSize();
+  hdr.indexedTime = timeStamp(shard.IndexedTime());
+
+  std::vector<uint64_t> starts(DIGEST_BUCKETS + 1);
+  std::vector<Digest> buckets(DIGEST_BUCKETS, Digest{});
+  std::string entries;
+  for (size_t b = 0; b < DIGEST_BUCKETS; ++b) {
+    std::vector<DigestedEntry> &list = byBucket[b];
+    std::sort(list.begin(), list.end(),
+              [](const DigestedEntry &x, const DigestedEntry &y) {
+                return x.name < y.name;
+              });
+    starts[b] = entries.size();
+    for (const DigestedEntry &entry : list) {
+      putVarint(entries, entry.name.size());
+      entries.append(entry.name);
+      entries.append(reinterpret_cast<const char *>(entry.digest.data()),
+                     DIGEST_SIZE);
+      xorInto(buckets[b], entry.digest);
+    }
+  }
+  starts[DIGEST_BUCKETS] = entries.size();
+
+  std::string file(DIGEST_ENTRIES_OFFSET, '\0');
+  memcpy(&file[0], &hdr, sizeof(hdr));
+  memcpy(&file[DIGEST_STARTS_OFFSET], starts.data(),
+         starts.size() * sizeof(uint64_t));
+  memcpy(&file[DIGEST_BUCKETS_OFFSET], buckets.data(),
+         buckets.size() * sizeof(Digest));
+  file.append(entries);
+  return file;
+}
+
+// Map the .sum file at path. Returns false if it is missing, damaged or not
+// about the file shard has open.
+bool VaultDigests::open(Sums &sums, const fs::path &path,
+                        const Shard &shard) const {
+  if (!sums.file.Open(path) || sums.file.Size() < DIGEST_ENTRIES_OFFSET) {
+    return false;
+  }
+  const char *data = sums.file.Data();
+  auto *hdr = reinterpret_cast<const DigestFileHeader *>(data);
+  if (memcmp(hdr->magic, DIGEST_MAGIC, 4) != 0 ||
+      hdr->version != DIGEST_VERSION || hdr->buckets != DIGEST_BUCKETS ||
+      hdr->indexedSize != shard.IndexedSize() ||
+      hdr->indexedTime != timeStamp(shard.IndexedTime())) {
+    return false;
+  }
+
+  auto *starts =
+      reinterpret_cast<const uint64_t *>(data + DIGEST_STARTS_OFFSET);
+  if (starts[0] != 0 ||
+      starts[DIGEST_BUCKETS] != sums.file.Size() - DIGEST_ENTRIES_OFFSET) {
+    return false;
+  }
+  for (size_t b = 0; b < DIGEST_BUCKETS; ++b) {
+    if (starts[b] > starts[b + 1]) {
+      return false;
+    }
+  }
+  sums.starts = starts;
+  sums.buckets =
+      reinterpret_cast<const Digest *>(data + DIGEST_BUCKETS_OFFSET);
+  sums.entries = data + DIGEST_ENTRIES_OFFSET;
+  return true;
+}
+
+// Call fn with the name and digest of every entry of bucket in sums, in name
+// order.
+template <typename Fn>
+static void forEachSum(const char *entries, const uint64_t *starts,
+                       size_t bucket, const Fn &fn) {
+  const char *p = entries + starts[bucket];
+  const char *end = entries + starts[bucket + 1];
+  while (p < end) {
+    uint64_t size;
+    if (!getVarint(p, end, size) || size > static_cast<uint64_t>(end - p) ||
+        static_cast<size_t>(end - p) - size < DIGEST_SIZE) {
+      throw std::runtime_error("vault digests are corrupted");
+    }
+    std::string_view name(p, size);
+    p += size;
+    Digest digest;
+    memcpy(digest.data(), p, DIGEST_SIZE);
+    p += DIGEST_SIZE;
+    fn(name, digest);
+  }
+}
+
+void VaultDigests::Load(const Vault &vault) {
+  cryptoInit();
+  shards.clear();
+  size = 0;
+  buckets.assign(DIGEST_BUCKETS, Digest{});
+  logged.assign(DIGEST_BUCKETS, {});
+
+  for (size_t i = 0; i < vault.ShardCount(); ++i) {
+    const Shard &shard = vault.GetShard(i);
+    fs::path path = shard.Path();
+    path.replace_extension(".sum");
+
+    auto sums = std::make_unique<Sums>();
+    if (!open(*sums, path, shard)) {
+      writeFileAtomic(path, buildSums(shard));
+      if (!open(*sums, path, shard)) {
+        throw std::runtime_error("unable to read " + path.string());
+      }
+    }
+    for (size_t b = 0; b < DIGEST_BUCKETS; ++b) {
+      xorInto(buckets[b], sums->buckets[b]);
+    }
+    size +=
+        reinterpret_cast<const DigestFileHeader *>(sums->file.Data())->count;
+
+    // A name the log overrides counts with its logged digest instead of its
+    // indexed one. Only the buckets holding such names are read.
+    std::vector<size_t> touched;
+    shard.ForEachLogged(
+        [this, &touched](const std::string &name, const PasswordEntry *entry) {
+          size_t b = digestBucket(name);
+          std::optional<Digest> digest;
+          if (entry != nullptr) {
+            digest = entryDigest(EntryView(*entry));
+            xorInto(buckets[b], *digest);
+            ++size;
+          }
+          logged[b][name] = digest;
+          touched.push_back(b);
+        });
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (size_t b : touched) {
+      forEachSum(sums->entries, sums->starts, b,
+                 [this, b](std::string_view name, const Digest &digest) {
+                   if (logged[b].count(name) != 0) {
+                     xorInto(buckets[b], digest);
+                     --size;
+                   }
+                 });
+    }
+    shards.push_back(std::move(sums));
+  }
+}
+
+std::vector<DigestedEntry> VaultDigests::Entries(size_t bucket) const {
+  std::vector<DigestedEntry> entries;
+  for (const auto &sums : shards) {
+    forEachSum(sums->entries, sums->starts, bucket,
+               [this, bucket, &entries](std::string_view name,
+                                        const Digest &digest) {
+                 if (logged[bucket].count(name) == 0) {
+                   entries.push_back(DigestedEntry{name, digest});
+                 }
+               });
+  }
+  for (auto &[name, digest] : logged[bucket]) {
+    if (digest) {
+      entries.push_back(DigestedEntry{name, *digest});
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const DigestedEntry &x, const DigestedEntry &y) {
+              return x.name < y.name;
+            });
+  return entries;
+}
+
+void VaultDigests::Update(std::string_view name,
+                          const std::optional<Digest> &before,
+                          const std::optional<Digest> &after) {
+  size_t b = digestBucket(name);
+  if (before) {
+    xorInto(buckets[b], *before);
+    --size;
+  }
+  if (after) {
+    xorInto(buckets[b], *after);
+    ++size;
+  }
+}
@@ -1,248 +1,625 @@
 #include "encryption.h"
+#include "cipher.h"
+#include "codec.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
-#include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/rand.h>
 #include <sodium.h>
+#include <cctype>
+#include <charconv>
+#include <cstring>
 #include <vector>
 
 #define EVP_SALT_SIZE 16 // 16 bytes (128 bits)
-#define HEX_RANGE "0123456789ABCDEF"
 
-PasswordManager::PasswordManager(const std::string secretKey) {
-  this->secretKey = secretKey;
-  init_encryption();
+// Key the entry ciphers use. It is derived from the whole secret, whereas
+// the legacy cipher only ever used its first 16 characters.
+static void deriveEntryKey(std::string_view secret, uint8_t *key) {
+  SecureString input = "epm-entry-key:";
+  input.append(secret.data(), secret.size());
+  crypto_generichash(key, CIPHER_KEY_SIZE,
+                     reinterpret_cast<const unsigned char *>(input.data()),
+                     input.size(), NULL, 0);
 }
 
-PasswordManager::~PasswordManager() {
-  // Cleanup OpenSSL
-  cleanup_encryption();
+PasswordManager::PasswordManager(std::string_view secretKey, CipherId cipher)
+    : entryKey(CIPHER_KEY_SIZE), cipher(cipher) {
+  cryptoInit();
+  this->secretKey.assign(secretKey.data(), secretKey.size());
+  deriveEntryKey(secretKey, entryKey.data());
 }
 
-std::string PasswordManager::encrypt(const std::string &plaintext,
-                                     const std::string *secret) {
-  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-  EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL,
-                     reinterpret_cast<const unsigned char *>(
-                         secret ? secret->c_str() : this->secretKey.c_str()),
-                     NULL);
+#define AES_KEY_SIZE 16
 
-  int ciphertext_len;
-  int len;
-  std::string ciphertext(
-      plaintext.size() + EVP_CIPHER_block_size(EVP_aes_128_ecb()), 0);
+#define KEY_FILE_MAGIC "EPMKEY"
+#define KEY_FILE_VERSION 2 // version 1 has no cipher name
+// Calibration never goes below 8 MiB or above 64 passes.
+#define KDF_MIN_MEMORY (8U * 1024 * 1024)
+#define KDF_MAX_OPS 64
 
-  EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char *>(&ciphertext[0]),
-                    &len,
-                    reinterpret_cast<const unsigned char *>(plaintext.c_str()),
-                    plaintext.length());
-  ciphertext_len = len;
+// AES-128-ECB fetched once per process. Only entries written before the AEAD
+// engines use it.
+static const EVP_CIPHER *aes128Ecb() {
+  static const EVP_CIPHER *aes = EVP_CIPHER_fetch(NULL, "AES-128-ECB", NULL);
+  if (aes == nullptr) {
+    throw std::runtime_error("AES-128-ECB is not available");
+  }
+  return aes;
+}
 
-  EVP_EncryptFinal_ex(ctx, reinterpret_cast<unsigned char *>(&ciphertext[len]),
-                      &len);
-  ciphertext_len += len;
+// Cipher contexts owned by one thread. Each direction remembers the last
+// secret it was keyed with and only re-keys when a call brings another one,
+// so a thread that decrypts with one key and encrypts with another (rekey)
+// sets up each key schedule once.
+struct CipherContext {
+  EVP_CIPHER_CTX *ctx = nullptr;
+  unsigned char key[AES_KEY_SIZE];
+  bool keyed = false;
+
+  ~CipherContext() {
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(key, sizeof(key));
+  }
+};
 
-  EVP_CIPHER_CTX_free(ctx);
+static thread_local CipherContext encryptContext;
+static thread_local CipherContext decryptContext;
 
-  // ciphertextlen is always longer than plaintextlen, so we need to trim the
-  // string
-  ciphertext.resize(ciphertext_len);
-  return ciphertext;
+static EVP_CIPHER_CTX *contextFor(std::string_view secret, bool encrypt) {
+  if (secret.size() < AES_KEY_SIZE) {
+    throw std::runtime_error("secret key is too short");
+  }
+
+  CipherContext &c = encrypt ? encryptContext : decryptContext;
+  if (c.ctx == nullptr) {
+    cryptoInit();
+    c.ctx = EVP_CIPHER_CTX_new();
+    if (c.ctx == nullptr) {
+      throw std::runtime_error("unable to allocate cipher context");
+    }
+  }
+
+  const unsigned char *key =
+      reinterpret_cast<const unsigned char *>(secret.data());
+  if (!c.keyed || CRYPTO_memcmp(c.key, key, AES_KEY_SIZE) != 0) {
+    if (encrypt) {
+      EVP_EncryptInit_ex(c.ctx, aes128Ecb(), NULL, key, NULL);
+    } else {
+      EVP_DecryptInit_ex(c.ctx, aes128Ecb(), NULL, key, NULL);
+    }
+    memcpy(c.key, key, AES_KEY_SIZE);
+    c.keyed = true;
+  }
+  return c.ctx;
 }
 
-std::string PasswordManager::decrypt(const std::string &ciphertext,
-                                     const std::string *secret) {
-  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-  EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL,
-                     reinterpret_cast<const unsigned char *>(
-                         secret ? secret->c_str() : this->secretKey.c_str()),
-                     NULL);
+// Seal one plaintext with engine into sealed, which is resized to fit.
+static void sealWith(const CipherEngine *engine, const uint8_t *key,
+                     std::string_view plaintext, std::string &sealed) {
+  sealed.resize(SEALED_HEADER_SIZE + engine->Overhead() + plaintext.size());
+  sealed[0] = static_cast<char>(SEALED_MAGIC);
+  sealed[1] = SEALED_VERSION;
+  sealed[2] = engine->Id();
+  uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  for (size_t i = 0; i < sizeof(now); ++i) {
+    sealed[SEALED_HEADER_SIZE_V1 + i] = static_cast<char>(now >> (8 * i));
+  }
+  engine->Seal(key, std::string_view(sealed.data(), SEALED_HEADER_SIZE),
+               plaintext, &sealed[SEALED_HEADER_SIZE]);
+}
 
-  int plaintext_len;
-  int len;
-  std::string plaintext(ciphertext.size(), 0);
+// The entry key for secret, or the manager's own if secret is null. A key
+// derived for another secret is written to scratch.
+const uint8_t *PasswordManager::keyFor(const SecureString *secret,
+                                       uint8_t *scratch) const {
+  if (secret == nullptr) {
+    if (entryKey.empty()) {
+      throw std::runtime_error("secret key is too short");
+    }
+    return entryKey.data();
+  }
+  deriveEntryKey(*secret, scratch);
+  return scratch;
+}
 
-  EVP_DecryptUpdate(ctx, reinterpret_cast<unsigned char *>(&plaintext[0]), &len,
-                    reinterpret_cast<const unsigned char *>(ciphertext.c_str()),
-                    ciphertext.length());
-  plaintext_len = len;
+// Wipes a derived entry key when leaving the scope, also by exception.
+struct KeyWiper {
+  uint8_t *key;
+  ~KeyWiper() { sodium_memzero(key, CIPHER_KEY_SIZE); }
+};
 
-  EVP_DecryptFinal_ex(ctx, reinterpret_cast<unsigned char *>(&plaintext[len]),
-                      &len);
-  plaintext_len += len;
+const CipherEngine *PasswordManager::engine() const {
+  const CipherEngine *engine = cipherEngine(cipher);
+  if (engine == nullptr) {
+    throw std::runtime_error("unknown cipher");
+  }
+  return engine;
+}
 
-  EVP_CIPHER_CTX_free(ctx);
+std::string PasswordManager::encrypt(std::string_view plaintext,
+                                     const SecureString *secret) {
+  stats::Timer timer(stats::PHASE_ENCRYPT);
+  stats::add(stats::CIPHER_CALLS);
+  uint8_t scratch[CIPHER_KEY_SIZE];
+  KeyWiper wiper{scratch};
+  std::string ciphertext;
+  sealWith(engine(), keyFor(secret, scratch), plaintext, ciphertext);
+  return ciphertext;
+}
+
+// Decrypt one ciphertext with a keyed context into plaintext, which is
+// resized to fit.
+template <typename String>
+static void decryptWith(EVP_CIPHER_CTX *ctx, std::string_view ciphertext,
+                        String &plaintext) {
+  EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, NULL);
+
+  int plaintext_len = 0;
+  int len = 0;
+  plaintext.resize(ciphertext.size() + EVP_MAX_BLOCK_LENGTH);
+
+  if (EVP_DecryptUpdate(
+          ctx, reinterpret_cast<unsigned char *>(&plaintext[0]), &len,
+          reinterpret_cast<const unsigned char *>(ciphertext.data()),
+          ciphertext.length()) == 1) {
+    plaintext_len = len;
+  }
 
-  // ciphertextlen is always longer than plaintextlen, so we need to trim the
-  // string
+  if (EVP_DecryptFinal_ex(
+          ctx, reinterpret_cast<unsigned char *>(&plaintext[plaintext_len]),
+          &len) != 1) {
+    // bad padding: the wrong key or a damaged entry
+    sodium_memzero(&plaintext[0], plaintext.size());
+    plaintext.clear();
+    throw std::runtime_error("entry could not be decrypted");
+  }
+  plaintext_len += len;
+
+  // the padding is stripped, so the plaintext is shorter than the buffer
   plaintext.resize(plaintext_len);
-  return plaintext;
 }
 
-std::string PasswordManager::GenerateKey(std::string masterPassword) {
-  if (sodium_init() < 0) {
-    // Panic! The library couldn't be initialized; it's not safe to use.
-    throw std::runtime_error("Sodium initialization failed.");
+// Engine a ciphertext was sealed with, or nullptr for a legacy one. Sets
+// headerSize to the size of its header.
+static const CipherEngine *sealedWith(std::string_view ciphertext,
+                                      size_t &headerSize) {
+  if (ciphertext.size() < SEALED_HEADER_SIZE_V1 ||
+      static_cast<uint8_t>(ciphertext[0]) != SEALED_MAGIC) {
+    return nullptr;
   }
+  if (ciphertext[1] == SEALED_VERSION) {
+    headerSize = SEALED_HEADER_SIZE;
+  } else if (ciphertext[1] == 1) {
+    headerSize = SEALED_HEADER_SIZE_V1;
+  } else {
+    return nullptr;
+  }
+  if (ciphertext.size() < headerSize) {
+    return nullptr;
+  }
+  return cipherEngine(static_cast<uint8_t>(ciphertext[2]));
+}
 
-  // Generate a random salt for password-based key derivation
-  std::vector<uint8_t> salt(crypto_pwhash_SALTBYTES);
-  randombytes_buf(salt.data(), salt.size());
+bool PasswordManager::IsLegacy(std::string_view ciphertext) {
+  size_t headerSize;
+  return sealedWith(ciphertext, headerSize) == nullptr;
+}
 
-  // Derive a key from the master password using Argon2
-  std::vector<uint8_t> derivedKey(crypto_secretbox_KEYBYTES);
-  if (crypto_pwhash(derivedKey.data(), derivedKey.size(),
-                    masterPassword.c_str(), masterPassword.length(),
-                    salt.data(), crypto_pwhash_OPSLIMIT_INTERACTIVE,
-                    crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                    crypto_pwhash_ALG_DEFAULT) != 0) {
-    throw std::runtime_error("Key derivation failed.");
+uint64_t PasswordManager::SealedTime(std::string_view ciphertext) {
+  size_t headerSize;
+  if (sealedWith(ciphertext, headerSize) == nullptr ||
+      headerSize != SEALED_HEADER_SIZE) {
+    return 0;
+  }
+  uint64_t time = 0;
+  const char *bytes = ciphertext.data() + SEALED_HEADER_SIZE_V1;
+  for (size_t i = 0; i < sizeof(time); ++i) {
+    time |= uint64_t(static_cast<uint8_t>(bytes[i])) << (8 * i);
   }
+  return time;
+}
 
-  // Convert the binary key to a hexadecimal string
-  std::string keyStr;
-  keyStr.reserve(derivedKey.size() * 2);
-  for (size_t i = 0; i < derivedKey.size(); ++i) {
-    keyStr += char(HEX_RANGE[((derivedKey[i] >> 4) & 0xF)]);
-    keyStr += char(HEX_RANGE[(derivedKey[i] & 0xF)]);
+// Open a sealed ciphertext with key, or decrypt a legacy one with secret.
+// Returns true if it was legacy. A legacy ciphertext that starts like a
+// sealed one fails authentication; with legacyFallback it is then decrypted
+// as legacy, and throws only if that fails too.
+template <typename String>
+static bool openWith(const uint8_t *key, std::string_view secret,
+                     std::string_view ciphertext, String &plaintext,
+                     bool legacyFallback) {
+  size_t headerSize;
+  const CipherEngine *engine = sealedWith(ciphertext, headerSize);
+  if (engine == nullptr) {
+    decryptWith(contextFor(secret, false), ciphertext, plaintext);
+    return true;
   }
 
-  // Encode the salt as a hexadecimal string and append it to the key
-  std::string saltStr;
-  saltStr.reserve(salt.size() * 2);
-  for (size_t i = 0; i < salt.size(); ++i) {
-    saltStr += char(HEX_RANGE[((salt[i] >> 4) & 0xF)]);
-    saltStr += char(HEX_RANGE[(salt[i] & 0xF)]);
+  std::string_view body = ciphertext.substr(headerSize);
+  size_t length = 0;
+  plaintext.resize(body.size());
+  if (engine->Open(key, ciphertext.substr(0, headerSize), body,
+                   &plaintext[0], length)) {
+    plaintext.resize(length);
+    return false;
   }
+  sodium_memzero(&plaintext[0], plaintext.size());
+  plaintext.clear();
+
+  // Legacy ciphertexts are whole AES blocks.
+  if (legacyFallback && ciphertext.size() % AES_KEY_SIZE == 0) {
+    try {
+      decryptWith(contextFor(secret, false), ciphertext, plaintext);
+      return true;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  throw std::runtime_error("entry failed authentication");
+}
 
-  keyStr += saltStr;
-  return keyStr;
+SecureString PasswordManager::decrypt(std::string_view ciphertext,
+                                      const SecureString *secret) {
+  stats::Timer timer(stats::PHASE_DECRYPT);
+  stats::add(stats::CIPHER_CALLS);
+  uint8_t scratch[CIPHER_KEY_SIZE];
+  KeyWiper wiper{scratch};
+  SecureString plaintext;
+  openWith(keyFor(secret, scratch), secret ? *secret : secretKey, ciphertext,
+           plaintext, true);
+  return plaintext;
 }
 
-bool PasswordManager::VerifyKey(const std::string &generatedKey,
-                                const std::string &masterPassword) {
-  // Check if the generated key has enough characters for the salt
-  if (generatedKey.length() !=
-      (crypto_secretbox_KEYBYTES * 2 + crypto_pwhash_SALTBYTES * 2)) {
-    return false;
+SecureString PasswordManager::decryptSealed(std::string_view ciphertext) {
+  if (IsLegacy(ciphertext)) {
+    throw std::runtime_error("entry is not sealed");
   }
+  stats::Timer timer(stats::PHASE_DECRYPT);
+  stats::add(stats::CIPHER_CALLS);
+  SecureString plaintext;
+  openWith(keyFor(nullptr, nullptr), secretKey, ciphertext, plaintext, false);
+  return plaintext;
+}
 
-  // Extract the salt from the generated key
-  std::string saltHex = generatedKey.substr(crypto_secretbox_KEYBYTES * 2);
+void PasswordManager::withPlaintext(
+    std::string_view ciphertext,
+    const std::function<void(std::string_view)> &fn,
+    const SecureString *secret, bool *legacy) {
+  stats::Timer timer(stats::PHASE_DECRYPT);
+  stats::add(stats::CIPHER_CALLS);
+  uint8_t key[CIPHER_KEY_SIZE];
+  KeyWiper keyWiper{key};
+  // Not kept across calls: a Scope ending would take its memory back.
+  SecureString plaintext;
+  bool wasLegacy = openWith(keyFor(secret, key), secret ? *secret : secretKey,
+                            ciphertext, plaintext, true);
+  if (legacy != nullptr) {
+    *legacy = wasLegacy;
+  }
+  fn(plaintext);
+}
 
-  // Convert the salt from a hexadecimal string to binary
-  std::vector<uint8_t> salt(crypto_pwhash_SALTBYTES);
-  for (size_t i = 0; i < crypto_pwhash_SALTBYTES; ++i) {
-    char highNibble = saltHex[2 * i];
-    char lowNibble = saltHex[2 * i + 1];
+void PasswordManager::encryptMany(const SecureString *plaintexts,
+                                  size_t count,
+                                  std::string *ciphertexts,
+                                  const SecureString *secret) {
+  stats::Timer timer(stats::PHASE_ENCRYPT);
+  stats::add(stats::CIPHER_CALLS, count);
+  uint8_t scratch[CIPHER_KEY_SIZE];
+  KeyWiper wiper{scratch};
+  const uint8_t *key = keyFor(secret, scratch);
+  const CipherEngine *engine = this->engine();
+
+  for (size_t i = 0; i < count; ++i) {
+    sealWith(engine, key, plaintexts[i], ciphertexts[i]);
+  }
+}
 
-    uint8_t highValue = (highNibble >= 'A' && highNibble <= 'F')
-                            ? (highNibble - 'A' + 10)
-                            : (highNibble - '0');
+void PasswordManager::decryptMany(const std::string *ciphertexts, size_t count,
+                                  SecureString *plaintexts,
+                                  const SecureString *secret) {
+  stats::Timer timer(stats::PHASE_DECRYPT);
+  stats::add(stats::CIPHER_CALLS, count);
+  uint8_t scratch[CIPHER_KEY_SIZE];
+  KeyWiper wiper{scratch};
+  const uint8_t *key = keyFor(secret, scratch);
+  std::string_view legacy = secret ? *secret : secretKey;
+
+  for (size_t i = 0; i < count; ++i) {
+    openWith(key, legacy, ciphertexts[i], plaintexts[i], true);
+  }
+}
 
-    uint8_t lowValue = (lowNibble >= 'A' && lowNibble <= 'F')
-                           ? (lowNibble - 'A' + 10)
-                           : (lowNibble - '0');
+void PasswordManager::decryptMany(const std::string_view *ciphertexts,
+                                  size_t count, SecureString *plaintexts,
+                                  const SecureString *secret) {
+  stats::Timer timer(stats::PHASE_DECRYPT);
+  stats::add(stats::CIPHER_CALLS, count);
+  uint8_t scratch[CIPHER_KEY_SIZE];
+  KeyWiper wiper{scratch};
+  const uint8_t *key = keyFor(secret, scratch);
+  std::string_view legacy = secret ? *secret : secretKey;
+
+  for (size_t i = 0; i < count; ++i) {
+    openWith(key, legacy, ciphertexts[i], plaintexts[i], true);
+  }
+}
+
+void PasswordManager::wipeSecret() {
+  secretKey.resize(secretKey.capacity());
+  sodium_memzero(&secretKey[0], secretKey.size());
+  secretKey.clear();
+  sodium_memzero(entryKey.data(), entryKey.size());
+  entryKey.clear();
+}
 
-    salt[i] = (highValue << 4) | lowValue;
+KdfParams PasswordManager::InteractiveKdfParams() {
+  return KdfParams{crypto_pwhash_ALG_DEFAULT,
+                   crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                   crypto_pwhash_MEMLIMIT_INTERACTIVE};
+}
+
+// Milliseconds one derivation with params takes.
+static double timeKdf(const KdfParams &params) {
+  unsigned char out[crypto_secretbox_KEYBYTES];
+  unsigned char salt[crypto_pwhash_SALTBYTES] = {0};
+  const char password[] = "calibration";
+
+  auto start = std::chrono::steady_clock::now();
+  if (crypto_pwhash(out, sizeof(out), password, sizeof(password) - 1, salt,
+                    params.opsLimit, params.memLimit, params.alg) != 0) {
+    throw std::runtime_error("Key derivation failed.");
   }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+KdfParams PasswordManager::CalibrateKdf(unsigned targetMs) {
+  cryptoInit();
 
-  // Extract the key part of the generated key
-  std::string keyHex = generatedKey.substr(0, crypto_secretbox_KEYBYTES * 2);
+  KdfParams params{crypto_pwhash_ALG_ARGON2ID13,
+                   crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                   crypto_pwhash_MEMLIMIT_INTERACTIVE};
+  double target = targetMs;
+  double ms = timeKdf(params);
 
-  // Convert the hexadecimal key string to a binary key
-  std::vector<uint8_t> derivedKey(crypto_secretbox_KEYBYTES);
-  for (size_t i = 0; i < derivedKey.size(); ++i) {
-    char highNibble = keyHex[2 * i];
-    char lowNibble = keyHex[2 * i + 1];
+  // Cost is roughly linear in memory times passes. Memory is what makes
+  // guessing expensive on GPUs, so it is adjusted first.
+  while (ms > target && params.memLimit / 2 >= KDF_MIN_MEMORY) {
+    params.memLimit /= 2;
+    ms = timeKdf(params);
+  }
+  while (ms > target && params.opsLimit > crypto_pwhash_argon2id_OPSLIMIT_MIN) {
+    --params.opsLimit;
+    ms = timeKdf(params);
+  }
+  while (ms * 2 <= target &&
+         params.memLimit * 2 <= crypto_pwhash_MEMLIMIT_MODERATE) {
+    params.memLimit *= 2;
+    ms = timeKdf(params);
+  }
 
-    uint8_t highValue = (highNibble >= 'A' && highNibble <= 'F')
-                            ? (highNibble - 'A' + 10)
-                            : (highNibble - '0');
+  // Spend the rest of the budget on passes.
+  if (ms > 0 && ms < target) {
+    double ops = params.opsLimit * target / ms;
+    params.opsLimit = std::max<unsigned long long>(
+        params.opsLimit,
+        std::min<double>(ops, static_cast<double>(KDF_MAX_OPS)));
+  }
+  return params;
+}
 
-    uint8_t lowValue = (lowNibble >= 'A' && lowNibble <= 'F')
-                           ? (lowNibble - 'A' + 10)
-                           : (lowNibble - '0');
+// Built by hand rather than with a stream, whose buffer would keep a copy of
+// the key outside the secure arena.
+SecureString formatKeyFile(std::string_view secret, const KdfParams &params,
+                           CipherId cipher) {
+  SecureString out;
+  out += KEY_FILE_MAGIC;
+  out += " " + std::to_string(KEY_FILE_VERSION) + " ";
+  out += params.alg == crypto_pwhash_ALG_ARGON2I13 ? "argon2i13" : "argon2id13";
+  out += " " + std::to_string(params.opsLimit) + " " +
+         std::to_string(params.memLimit) + " ";
+  out += cipherEngine(cipher)->Name();
+  out += "\n";
+  out.append(secret.data(), secret.size());
+  out += "\n";
+  return out;
+}
 
-    derivedKey[i] = (highValue << 4) | lowValue;
+// Next whitespace-separated word of text, which is advanced past it. Empty
+// at the end of the text.
+static std::string_view nextWord(std::string_view &text) {
+  auto space = [&text](size_t i) {
+    return isspace(static_cast<unsigned char>(text[i])) != 0;
+  };
+  size_t begin = 0;
+  while (begin < text.size() && space(begin)) {
+    ++begin;
   }
+  size_t end = begin;
+  while (end < text.size() && !space(end)) {
+    ++end;
+  }
+  std::string_view word = text.substr(begin, end - begin);
+  text.remove_prefix(end);
+  return word;
+}
 
-  // Derive a key from the master password using Argon2 with the extracted salt
-  std::vector<uint8_t> verifiedDerivedKey(crypto_secretbox_KEYBYTES);
-  if (crypto_pwhash(verifiedDerivedKey.data(), verifiedDerivedKey.size(),
-                    masterPassword.c_str(), masterPassword.length(),
-                    salt.data(), crypto_pwhash_OPSLIMIT_INTERACTIVE,
-                    crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                    crypto_pwhash_ALG_DEFAULT) != 0) {
+template <typename T> static bool parseNumber(std::string_view word, T &value) {
+  const char *end = word.data() + word.size();
+  std::from_chars_result result = std::from_chars(word.data(), end, value);
+  return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseKeyFile(std::string_view text, SecureString &secret,
+                  KdfParams &params, CipherId &cipher) {
+  std::string_view first = nextWord(text);
+  if (first.empty()) {
     return false;
   }
 
-  // Compare the derived key to the verified derived key
-  return derivedKey == verifiedDerivedKey;
+  if (first != KEY_FILE_MAGIC) {
+    secret.assign(first.data(), first.size());
+    params = PasswordManager::InteractiveKdfParams();
+    cipher = CIPHER_AES_256_GCM;
+    return true;
+  }
+
+  unsigned version;
+  if (!parseNumber(nextWord(text), version) || version < 1 ||
+      version > KEY_FILE_VERSION) {
+    return false;
+  }
+  std::string_view alg = nextWord(text);
+  if (!parseNumber(nextWord(text), params.opsLimit) ||
+      !parseNumber(nextWord(text), params.memLimit)) {
+    return false;
+  }
+  cipher = CIPHER_AES_256_GCM;
+  if (version >= 2) {
+    const CipherEngine *engine = cipherEngineNamed(nextWord(text));
+    if (engine == nullptr) {
+      return false;
+    }
+    cipher = engine->Id();
+  }
+  std::string_view key = nextWord(text);
+  if (key.empty()) {
+    return false;
+  }
+  secret.assign(key.data(), key.size());
+
+  unsigned long long minOps;
+  if (alg == "argon2id13") {
+    params.alg = crypto_pwhash_ALG_ARGON2ID13;
+    minOps = crypto_pwhash_argon2id_OPSLIMIT_MIN;
+  } else if (alg == "argon2i13") {
+    params.alg = crypto_pwhash_ALG_ARGON2I13;
+    minOps = crypto_pwhash_argon2i_OPSLIMIT_MIN;
+  } else {
+    return false;
+  }
+  return params.opsLimit >= minOps &&
+         params.opsLimit <= crypto_pwhash_OPSLIMIT_MAX &&
+         params.memLimit >= crypto_pwhash_MEMLIMIT_MIN &&
+         params.memLimit <= crypto_pwhash_MEMLIMIT_MAX;
 }
 
-void PasswordManager::init_encryption() {
-  OpenSSL_add_all_algorithms();
-  OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
-  RAND_poll();
+uint32_t PasswordManager::KeyFingerprint(std::string_view key) {
+  cryptoInit();
+  unsigned char digest[crypto_generichash_BYTES_MIN];
+  SecureString input = "epm-key-id:";
+  input.append(key.data(), key.size());
+  crypto_generichash(digest, sizeof(digest),
+                     reinterpret_cast<const unsigned char *>(input.data()),
+                     input.size(), NULL, 0);
+
+  uint32_t id;
+  memcpy(&id, digest, sizeof(id));
+  return id != 0 ? id : 1; // 0 means unknown
 }
 
-void PasswordManager::cleanup_encryption() {
-  EVP_cleanup();
-  CRYPTO_cleanup_all_ex_data();
+SecureString PasswordManager::GenerateKey(std::string_view masterPassword,
+                                          const KdfParams &params) {
+  // Throws if the library couldn't be initialized; it's not safe to use.
+  cryptoInit();
+
+  // Generate a random salt for password-based key derivation
+  std::vector<uint8_t> salt(crypto_pwhash_SALTBYTES);
+  randombytes_buf(salt.data(), salt.size());
+
+  // Derive a key from the master password using Argon2
+  stats::Timer timer(stats::PHASE_KDF);
+  std::vector<uint8_t, SecureAllocator<uint8_t>> derivedKey(
+      crypto_secretbox_KEYBYTES);
+  if (crypto_pwhash(derivedKey.data(), derivedKey.size(),
+                    masterPassword.data(), masterPassword.length(),
+                    salt.data(), params.opsLimit, params.memLimit,
+                    params.alg) != 0) {
+    throw std::runtime_error("Key derivation failed.");
+  }
+
+  // Key and salt are stored as uppercase hex, key first
+  SecureString keyStr((derivedKey.size() + salt.size()) * 2, '\0');
+  codec::hexEncode(derivedKey.data(), derivedKey.size(), &keyStr[0], true);
+  codec::hexEncode(salt.data(), salt.size(), &keyStr[derivedKey.size() * 2],
+                   true);
+  return keyStr;
 }
 
-std::string PasswordManager::base64Encode(const std::string &binaryData) {
-  // Encode binary data to Base64
-  BIO *b64 = BIO_new(BIO_f_base64());
-  BIO *bio = BIO_new(BIO_s_mem());
-  BIO_push(b64, bio);
+bool PasswordManager::VerifyKey(std::string_view generatedKey,
+                                std::string_view masterPassword,
+                                const KdfParams &params) {
+  // Check if the generated key has enough characters for the salt
+  if (generatedKey.length() !=
+      (crypto_secretbox_KEYBYTES * 2 + crypto_pwhash_SALTBYTES * 2)) {
+    return false;
+  }
+
+  cryptoInit();
+
+  // Split the key file into the derived key and its salt
+  std::vector<uint8_t, SecureAllocator<uint8_t>> derivedKey(
+      crypto_secretbox_KEYBYTES);
+  std::vector<uint8_t> salt(crypto_pwhash_SALTBYTES);
+  if (!codec::hexDecode(generatedKey.data(), derivedKey.size() * 2,
+                        derivedKey.data()) ||
+      !codec::hexDecode(generatedKey.data() + derivedKey.size() * 2,
+                        salt.size() * 2, salt.data())) {
+    return false;
+  }
 
-  BIO_write(b64, binaryData.c_str(), binaryData.length());
-  BIO_flush(b64);
+  // Derive a key from the master password using Argon2 with the extracted salt
+  stats::Timer timer(stats::PHASE_KDF);
+  std::vector<uint8_t, SecureAllocator<uint8_t>> verifiedDerivedKey(
+      crypto_secretbox_KEYBYTES);
+  if (crypto_pwhash(verifiedDerivedKey.data(), verifiedDerivedKey.size(),
+                    masterPassword.data(), masterPassword.length(),
+                    salt.data(), params.opsLimit, params.memLimit,
+                    params.alg) != 0) {
+    return false;
+  }
 
-  char encodedData[512]; // Adjust the buffer size as needed
-  int len = BIO_read(bio, encodedData, sizeof(encodedData));
-  std::string base64Data(encodedData, len);
+  // Compare the derived key to the verified derived key
+  return derivedKey == verifiedDerivedKey;
+}
 
-  BIO_free_all(b64);
+std::string PasswordManager::base64Encode(const std::string &binaryData) {
+  std::string base64Data(codec::base64EncodedSize(binaryData.size()), '\0');
+  codec::base64Encode(reinterpret_cast<const uint8_t *>(binaryData.data()),
+                      binaryData.size(), &base64Data[0]);
   return base64Data;
 }
 
 std::string PasswordManager::base64Decode(const std::string &base64Data) {
-  // Decode Base64 data to binary
-  BIO *b64 = BIO_new(BIO_f_base64());
-  BIO *bio = BIO_new_mem_buf(base64Data.c_str(), base64Data.length());
-  BIO_push(b64, bio);
-
-  char decodedData[512];
-  int len = BIO_read(b64, decodedData, sizeof(decodedData));
-  std::string binaryData(decodedData, len);
-
-  BIO_free_all(b64);
+  std::string binaryData(codec::base64DecodedMaxSize(base64Data.size()), '\0');
+  size_t written;
+  if (!codec::base64Decode(base64Data.data(), base64Data.size(),
+                           reinterpret_cast<uint8_t *>(&binaryData[0]),
+                           &written)) {
+    throw std::runtime_error("invalid base64 data");
+  }
+  binaryData.resize(written);
   return binaryData;
 }
 
 std::string PasswordManager::hexEncode(const std::string &binaryData) {
-  // Encode binary data to hexadecimal
-  std::string hexData;
-  for (unsigned char byte : binaryData) {
-    char hexBuffer[3];
-    snprintf(hexBuffer, sizeof(hexBuffer), "%02x", byte);
-    hexData += hexBuffer;
-  }
+  std::string hexData(binaryData.size() * 2, '\0');
+  codec::hexEncode(reinterpret_cast<const uint8_t *>(binaryData.data()),
+                   binaryData.size(), &hexData[0]);
   return hexData;
 }
 
 std::string PasswordManager::hexDecode(const std::string &hexData) {
-  // Decode hexadecimal data to binary
-  std::string binaryData;
-  for (size_t i = 0; i < hexData.length(); i += 2) {
-    std::string byteStr = hexData.substr(i, 2);
-    unsigned char byte =
-        static_cast<unsigned char>(std::stoi(byteStr, nullptr, 16));
-    binaryData += byte;
+  std::string binaryData(hexData.size() / 2, '\0');
+  if (!codec::hexDecode(hexData.data(), hexData.size(),
+                        reinterpret_cast<uint8_t *>(&binaryData[0]))) {
+    throw std::runtime_error("invalid hex data");
   }
   return binaryData;
 }
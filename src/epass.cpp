@@ -1,32 +1,100 @@
 #include "epass.h"
+#include "agent.h"
 #include "input.h"
+#include "keyfile.h"
+#include "keyring.h"
+#include "search.h"
+#include "stats.h"
+#include "sync.h"
+#include "threadpool.h"
 #include "utils.h"
 
-#define KEY_FILE "epm.key"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <iterator>
+#include <limits>
+#include <sodium.h>
+#include <vector>
+
+#define AGENT_SOCKET "agent.sock"
+#define IMPORT_CHUNK 8192
+#define REKEY_CHUNK 1024
+#define EXPORT_CHUNK 4096
+#define GENERATE_CHUNK 8192
+#define PRINT_CHUNK_BYTES (64 * 1024) // printed passwords per write, in bytes
 
 Epass::Epass() {
   path = getPlatformPath();
+  if (path.empty()) {
+    std::cout << "Could not get HOME environment variable. Using current path"
+              << std::endl;
+    path = fs::current_path();
+  }
   makeDirs(path);
   baseDir = path.parent_path();
 }
 
 bool Epass::KeyExists() { return fs::exists(baseDir / KEY_FILE); }
 
-void Epass::GenerateKey() {
+void Epass::GenerateKey(unsigned targetMs) {
   // check if the key file already exists
   if (fs::exists(baseDir / KEY_FILE)) {
-    std::cout << "Key file already exists. Overwrite? [y/N] ";
+    std::cout << "Key file already exists. Entries encrypted with it become "
+                 "unreadable; use 'epm rekey' to change the master password "
+                 "instead. Overwrite? [y/N] ";
     std::string response;
     std::cin >> response;
     if (response != "y" && response != "Y") {
       std::cout << "Aborting." << std::endl;
       return;
     }
+    // Drop the rest of the line so the password prompt starts fresh.
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+
+  SecureString masterPassword = requestNewPassword();
+  KdfParams params = PasswordManager::InteractiveKdfParams();
+  if (targetMs > 0) {
+    std::cout << "Calibrating key derivation for " << targetMs << " ms..."
+              << std::endl;
+    try {
+      params = PasswordManager::CalibrateKdf(targetMs);
+    } catch (const std::runtime_error &e) {
+      std::cout << "Could not calibrate: " << e.what() << std::endl;
+      exit(1);
+    }
+    std::cout << "Using Argon2id with " << params.opsLimit << " passes over "
+              << params.memLimit / (1024 * 1024) << " MiB." << std::endl;
+  }
+
+  SecureString secret = pm.GenerateKey(masterPassword, params);
+  std::cout << "Generated new secret key: " << secret << std::endl;
+
+  // Entries are sealed with whichever engine is fastest on this machine,
+  // usually AES-256-GCM where the CPU has AES instructions.
+  CipherId cipher = fastestCipher();
+  std::cout << "Encrypting entries with " << cipherEngine(cipher)->Name()
+            << "." << std::endl;
+
+  std::fstream file(baseDir / KEY_FILE, std::ios::out | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cout << "Could not open key file for writing." << std::endl;
+    return;
   }
 
+  file << formatKeyFile(secret, params, cipher);
+  std::cout << "Key file written to " << baseDir / KEY_FILE << std::endl;
+  file.close();
+}
+
+SecureString Epass::requestNewPassword() {
+  stats::Timer timer(stats::PHASE_PROMPT);
   // Prompt for master password
-  std::string masterPassword;
-  std::string confirmMasterPassword;
+  SecureString masterPassword;
+  SecureString confirmMasterPassword;
   std::string prompt = "Enter a secret master password: ";
   char echoChar = '*';
   masterPassword = requestUserPassword(prompt, echoChar);
@@ -47,73 +115,84 @@ void Epass::GenerateKey() {
     std::cout << "Passwords do not match." << std::endl;
     exit(1);
   }
+  return masterPassword;
+}
 
-  std::string secret = pm.GenerateKey(masterPassword);
-  std::cout << "Generated new secret key: " << secret << std::endl;
-
-  // TODO: save the secret key to a file
-  std::fstream file(baseDir / KEY_FILE, std::ios::out | std::ios::trunc);
-  if (!file.is_open()) {
-    std::cout << "Could not open key file for writing." << std::endl;
-    return;
-  }
-
-  file << secret;
-  std::cout << "Key file written to " << baseDir / KEY_FILE << std::endl;
-  file.close();
+std::string Epass::keyDescription() const {
+  return "epm:" + fs::absolute(baseDir / KEY_FILE).string();
 }
 
-void Epass::Init() {
-  if (KeyExists()) {
-    std::fstream file(baseDir / KEY_FILE, std::ios::in);
-    if (!file.is_open()) {
-      std::cout << "Could not open key file for reading. Try again!!"
+SecureString Epass::readKey() {
+  stats::Timer timer(stats::PHASE_READ_KEY);
+  recoverRekey(baseDir, path);
+
+  SecureString secret;
+  try {
+    if (!readKeyFile(baseDir, secret, kdf, cipher)) {
+      std::cout << "Secret Key file does not exist. Please run 'epm keygen' "
+                   "to generate a secret key."
                 << std::endl;
       exit(1);
     }
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not read the key: " << e.what() << "." << std::endl;
+    exit(1);
+  }
+  return secret;
+}
 
-    std::string secret;
-    file >> secret;
-    pm = PasswordManager(secret);
-    file.close();
+void Epass::Init(unsigned cacheSeconds) {
+  SecureString secret = readKey();
+  pm = PasswordManager(secret, cipher);
 
+  // A recent 'epm unlock' leaves the verified key in the session keyring.
+  // It only counts if the key file has not been regenerated since.
+  SecureString cached;
+  bool unlocked = keyringLoad(keyDescription(), cached) && cached == secret;
+
+  if (!unlocked) {
     // ask for master password
-    std::string masterPassword;
+    SecureString masterPassword;
     std::string prompt = "Enter master password: ";
     char echoChar = '*';
-    masterPassword = requestUserPassword(prompt, echoChar);
+    {
+      stats::Timer timer(stats::PHASE_PROMPT);
+      masterPassword = requestUserPassword(prompt, echoChar);
+    }
 
     // check if the key is valid
-    if (!pm.VerifyKey(secret, masterPassword)) {
+    if (!pm.VerifyKey(secret, masterPassword, kdf)) {
       std::cout << "Invalid master password." << std::endl;
       exit(1);
     }
-  } else {
-    std::cout << "Secret Key file does not exist. Please run 'epm keygen' to "
-                 "generate a secret key."
+  }
+
+  if (cacheSeconds > 0 &&
+      !keyringStore(keyDescription(), secret, cacheSeconds)) {
+    std::cout << "Could not cache the key in the session keyring."
               << std::endl;
     exit(1);
   }
 
-  // Clear existing entries
-  entries.clear();
+  openVault();
+}
 
-  // Open the file for reading
-  std::fstream file(path, std::ios::in | std::ios::binary);
-  if (!file.is_open()) {
-    std::cout << "Could not open file for reading." << std::endl;
-    return;
+bool Epass::Unlock(std::string_view masterPassword) {
+  SecureString secret = readKey();
+  pm = PasswordManager(secret, cipher);
+  if (!pm.VerifyKey(secret, masterPassword, kdf)) {
+    return false;
   }
+  openVault();
+  return true;
+}
 
-  // if file is empty, return
-  std::uintmax_t fileSize = fs::file_size(path);
-  std::uintmax_t minSize = sizeof(PasswordEntry);
-
-  if (fileSize == 0) {
-    return;
-  }
+bool Epass::Lock() { return keyringClear(keyDescription()); }
 
-  if (fileSize < minSize) {
+void Epass::openVault() {
+  try {
+    vault.Open(path);
+  } catch (const std::runtime_error &) {
     // data corrupted
     std::cout << "data appears to be corrupted. Other operations may fail or "
                  "return wrong passwords"
@@ -124,52 +203,63 @@ void Epass::Init() {
     std::cin >> answer;
 
     if (answer == "y" || answer == "Y") {
-      // Set the write position to the beginning of the file
-      file.seekp(0, std::ios::beg);
-      file << "";
-      file.flush();
+      fs::remove(path);
+      vault.Open(path);
     }
-    return;
-  }
-
-  // Read the binary data
-  while (file.good() && !file.eof()) {
-    PasswordEntry entry;
-    entry.Deserialize(file);
-    entries[entry.GetName()] = entry;
   }
 }
 
 void Epass::AddEntry(const std::string &name, const std::string &password) {
   std::string encryptedPassword = pm.encrypt(password);
-  PasswordEntry entry(name, encryptedPassword);
-  entries[entry.GetName()] = entry;
+  vault.Put(PasswordEntry(name, encryptedPassword));
   save();
 }
 
 void Epass::PrintEntry(std::string name) {
-  for (auto &[_, entry] : entries) {
-    if (entry.GetName() == name) {
-      std::cout << entry;
-      return;
-    }
+  std::optional<EntryView> entry = vault.Find(name);
+  if (entry) {
+    std::cout << *entry;
   }
 }
 
+// Print the name and password of entry. An entry still encrypted with the
+// legacy cipher is sealed again and staged; returns true if it was.
+bool Epass::printPassword(const EntryView &entry) {
+  std::cout << entry.GetName() << std::endl;
+  bool legacy = false;
+  std::string sealed;
+  pm.withPlaintext(
+      entry.GetPassword(),
+      [this, &legacy, &sealed](std::string_view password) {
+        std::cout << password << std::endl;
+        if (legacy) {
+          sealed = pm.encrypt(password);
+        }
+      },
+      nullptr, &legacy);
+  if (legacy) {
+    vault.Put(PasswordEntry(std::string(entry.GetName()), sealed));
+  }
+  return legacy;
+}
+
 void Epass::PrintRawEntry(std::string name) {
-  for (auto &[_, entry] : entries) {
-    if (entry.GetName() == name) {
-      std::cout << entry.GetName() << std::endl;
-      std::string decryptedPassword = pm.decrypt(entry.GetPassword());
-      std::cout << decryptedPassword << std::endl;
+  try {
+    std::optional<EntryView> entry = vault.Find(name);
+    if (!entry) {
       return;
     }
+    if (printPassword(*entry)) {
+      save();
+    }
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not read entry: " << e.what() << std::endl;
+    exit(1);
   }
 }
 
 void Epass::DeleteEntry(std::string name) {
-  size_t erasedKeys = entries.erase(name);
-  if (erasedKeys == 0) {
+  if (!vault.Remove(name)) {
     std::cout << "No entry with name '" << name << "'." << std::endl;
     return;
   }
@@ -177,29 +267,551 @@ void Epass::DeleteEntry(std::string name) {
 }
 
 void Epass::ListEntries() {
-  if (entries.empty()) {
+  bool empty = true;
+  vault.ForEach([&empty](const EntryView &entry) {
+    std::cout << entry.GetName() << std::endl;
+    std::cout << "-------------------------" << std::endl;
+    empty = false;
+  });
+
+  if (empty) {
     std::cout << "No entries." << std::endl;
-    return;
   }
+}
 
-  for (auto &[name, _] : entries) {
-    std::cout << name << std::endl;
-    std::cout << "-------------------------" << std::endl;
+void Epass::Rekey() {
+  SecureString reply;
+  if (agentRequest(AgentSocket(), {"ping"}, reply)) {
+    std::cout << "An agent is running with the current key. Stop it with "
+                 "'epm lock' first."
+              << std::endl;
+    exit(1);
   }
+
+  Init();
+  std::cout << "Choose the new master password." << std::endl;
+  Rekey(requestNewPassword());
 }
 
-void Epass::save() {
-  std::fstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
-  if (!file.is_open()) {
-    std::cout << "Could not open file for writing." << std::endl;
+void Epass::Rekey(std::string_view newPassword) {
+  auto start = std::chrono::steady_clock::now();
+  // The new key keeps the KDF settings of the current one.
+  SecureString newSecret = pm.GenerateKey(newPassword, kdf);
+  size_t count = 0;
+
+  try {
+    // Other writers wait until the vault is switched over; anything they
+    // committed before is re-encrypted with the rest.
+    vault.LockExclusive();
+
+    // A log left behind by the final compaction would be replayed over the
+    // re-encrypted entries, so fold it in before anything changes.
+    if (vault.LogRecords() > 0) {
+      vault.Compact();
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::string> ciphertexts;
+    vault.ForEach([&](const EntryView &entry) {
+      names.emplace_back(entry.GetName());
+      ciphertexts.emplace_back(entry.GetPassword());
+    });
+    count = names.size();
+
+    // Each worker decrypts a chunk with the old key and encrypts it with the
+    // new one in place; plaintexts never outlive their chunk.
+    ThreadPool pool;
+    pool.ParallelFor(ciphertexts.size(), REKEY_CHUNK,
+                     [&](size_t begin, size_t end) {
+                       SecureStrings plaintexts(end - begin);
+                       pm.decryptMany(&ciphertexts[begin], end - begin,
+                                      plaintexts.data());
+                       pm.encryptMany(plaintexts.data(), end - begin,
+                                      &ciphertexts[begin], &newSecret);
+                     });
+
+    for (size_t i = 0; i < names.size(); ++i) {
+      vault.Put(PasswordEntry(names[i], ciphertexts[i]));
+    }
+    vault.SetKeyId(PasswordManager::KeyFingerprint(newSecret));
+
+    writeFileAtomic(baseDir / REKEY_FILE,
+                    formatKeyFile(newSecret, kdf, cipher));
+    vault.Compact();
+    fs::rename(baseDir / REKEY_FILE, baseDir / KEY_FILE);
+    vault.Unlock();
+  } catch (const std::exception &e) {
+    std::cout << "Could not rekey the vault: " << e.what() << std::endl;
+    exit(1);
+  }
+
+  // The keyring may still hold the old key.
+  Lock();
+  pm = PasswordManager(newSecret, cipher);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Re-encrypted " << count << " entries in " << elapsed.count()
+            << "s." << std::endl;
+}
+
+void Epass::SearchEntries(const std::string &query, size_t limit) {
+  openVault();
+
+  std::vector<std::pair<int, std::string>> ranked;
+  vault.ForEachName("", [&](std::string_view name) {
+    int score = fuzzyScore(query, name);
+    if (score >= 0) {
+      ranked.emplace_back(score, std::string(name));
+    }
+  });
+
+  // Best score first; shorter names win ties, then byte order.
+  auto better = [](const std::pair<int, std::string> &a,
+                   const std::pair<int, std::string> &b) {
+    if (a.first != b.first) {
+      return a.first > b.first;
+    }
+    if (a.second.size() != b.second.size()) {
+      return a.second.size() < b.second.size();
+    }
+    return a.second < b.second;
+  };
+  size_t shown = std::min(limit, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                    better);
+
+  if (shown == 0) {
+    std::cout << "No matches." << std::endl;
     return;
   }
+  for (size_t i = 0; i < shown; ++i) {
+    std::cout << ranked[i].second << '\n';
+  }
+  std::cout.flush();
+}
+
+void Epass::CompleteNames(const std::string &prefix) {
+  try {
+    vault.Open(path);
+    vault.ForEachName(prefix, [](std::string_view name) {
+      std::cout << name << '\n';
+    });
+  } catch (const std::runtime_error &) {
+    // Completion must stay quiet; the next real command reports the problem.
+  }
+  std::cout.flush();
+}
+
+void Epass::ImportEntries(std::istream &input, RecordFormat format) {
+  RecordReader reader(input, format);
+  ThreadPool pool;
+
+  std::vector<Credential> chunk;
+  SecureStrings plaintexts(IMPORT_CHUNK);
+  std::vector<std::string> ciphers(IMPORT_CHUNK);
+  size_t imported = 0;
+  size_t skipped = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  // Parse a chunk, encrypt it across the pool and stage it. Nothing reaches
+  // the disk until the single commit at the end.
+  bool more = true;
+  while (more) {
+    chunk.clear();
+    try {
+      Credential record;
+      while (chunk.size() < IMPORT_CHUNK && (more = reader.Next(record))) {
+        chunk.push_back(std::move(record));
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << std::endl;
+      std::cout << "Import failed at " << e.what()
+                << ". Nothing was imported." << std::endl;
+      exit(1);
+    }
+
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      plaintexts[i].swap(chunk[i].password);
+    }
+
+    pool.ParallelFor(chunk.size(), 256, [&](size_t begin, size_t end) {
+      pm.encryptMany(&plaintexts[begin], end - begin, &ciphers[begin]);
+    });
 
-  for (auto &[_, entry] : entries) {
-    if (entry.GetName().empty() || entry.GetPassword().empty()) {
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      if (chunk[i].name.empty() || chunk[i].name.size() > ENTRY_MAX_NAME ||
+          plaintexts[i].empty() || plaintexts[i].size() > ENTRY_MAX_SECRET) {
+        ciphers[i].clear();
+      }
+    }
+
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      if (ciphers[i].empty()) {
+        std::cerr << "\rSkipping '" << chunk[i].name
+                  << "': name or password is empty or too long." << std::endl;
+        ++skipped;
+        continue;
+      }
+      vault.Put(PasswordEntry(chunk[i].name, ciphers[i]));
+      ++imported;
+    }
+
+    // The buffers go back to the next chunk's records; wipe them first,
+    // earlier, longer passwords included.
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      plaintexts[i].resize(plaintexts[i].capacity());
+      sodium_memzero(&plaintexts[i][0], plaintexts[i].size());
+      plaintexts[i].clear();
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "\rEncrypted " << imported << " entries ("
+              << static_cast<size_t>(imported / std::max(elapsed.count(), 1e-9))
+              << " entries/s)" << std::flush;
+  }
+  std::cerr << std::endl;
+
+  save();
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Imported " << imported << " entries";
+  if (skipped > 0) {
+    std::cout << ", skipped " << skipped;
+  }
+  std::cout << " in " << elapsed.count() << "s." << std::endl;
+}
+
+void Epass::PrintGenerated(std::ostream &output, size_t count,
+                           PasswordGenerator &generator) {
+  // Lines are built in a secure buffer and written a chunk at a time.
+  size_t line = generator.Length() + 1;
+  size_t chunk = std::max(size_t(1), size_t(PRINT_CHUNK_BYTES) / line);
+  SecureString buffer(std::min(count, chunk) * line, '\n');
+  for (size_t done = 0; done < count;) {
+    size_t n = std::min(count - done, chunk);
+    for (size_t i = 0; i < n; ++i) {
+      generator.Generate(&buffer[i * line]);
+    }
+    output.write(buffer.data(), n * line);
+    done += n;
+  }
+  output.flush();
+}
+
+// Name of the index-th generated entry.
+static std::string generatedName(const std::string &pattern, size_t index) {
+  std::string name = pattern;
+  size_t at = name.find("{n}");
+  if (at != std::string::npos) {
+    name.replace(at, 3, std::to_string(index));
+  }
+  return name;
+}
+
+void Epass::StoreGenerated(const std::string &pattern, size_t count,
+                           PasswordGenerator &generator) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 1; i <= count; ++i) {
+    std::string name = generatedName(pattern, i);
+    if (name.size() > ENTRY_MAX_NAME) {
+      std::cout << "Name '" << name << "' is too long." << std::endl;
+      exit(1);
+    }
+    if (vault.Find(name)) {
+      std::cout << "Entry '" << name << "' already exists. Nothing was stored."
+                << std::endl;
+      exit(1);
+    }
+  }
+
+  // Generate a chunk, encrypt it across the pool and stage it; the commit at
+  // the end writes everything at once.
+  ThreadPool pool;
+  SecureStrings plaintexts(GENERATE_CHUNK,
+                           SecureString(generator.Length(), '\0'));
+  std::vector<std::string> ciphers(GENERATE_CHUNK);
+  for (size_t done = 0; done < count;) {
+    size_t n = std::min(count - done, size_t(GENERATE_CHUNK));
+    for (size_t i = 0; i < n; ++i) {
+      generator.Generate(&plaintexts[i][0]);
+    }
+    pool.ParallelFor(n, 256, [&](size_t begin, size_t end) {
+      pm.encryptMany(&plaintexts[begin], end - begin, &ciphers[begin]);
+    });
+    for (size_t i = 0; i < n; ++i) {
+      vault.Put(PasswordEntry(generatedName(pattern, done + i + 1), ciphers[i]));
+    }
+    done += n;
+  }
+  plaintexts.clear(); // wiped as they are destroyed
+
+  save();
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Stored " << count << " generated passwords ("
+            << static_cast<int>(generator.EntropyBits()) << " bits each) in "
+            << elapsed.count() << "s." << std::endl;
+}
+
+fs::path Epass::AgentSocket() const { return baseDir / AGENT_SOCKET; }
+
+void Epass::ExportEntries(std::ostream &output, RecordFormat format) {
+  RecordWriter writer(output, format);
+  ThreadPool pool;
+
+  // Views into the vault for one chunk, and reused plaintext buffers.
+  std::vector<std::string_view> names;
+  std::vector<std::string_view> ciphers;
+  SecureStrings plaintexts(EXPORT_CHUNK);
+  names.reserve(EXPORT_CHUNK);
+  ciphers.reserve(EXPORT_CHUNK);
+  size_t exported = 0;
+
+  // Decrypt a chunk across the pool, then write it in vault order. Each
+  // plaintext is wiped once written, before the next chunk reuses it.
+  auto writeChunk = [&]() {
+    pool.ParallelFor(names.size(), 256, [&](size_t begin, size_t end) {
+      pm.decryptMany(&ciphers[begin], end - begin, &plaintexts[begin]);
+    });
+    for (size_t i = 0; i < names.size(); ++i) {
+      writer.Write(names[i], plaintexts[i]);
+      sodium_memzero(&plaintexts[i][0], plaintexts[i].size());
+    }
+    exported += names.size();
+    names.clear();
+    ciphers.clear();
+  };
+
+  try {
+    vault.ForEach([&](const EntryView &entry) {
+      names.push_back(entry.GetName());
+      ciphers.push_back(entry.GetPassword());
+      if (names.size() == EXPORT_CHUNK) {
+        writeChunk();
+      }
+    });
+    writeChunk();
+    writer.Flush();
+  } catch (const std::runtime_error &e) {
+    // stdout may be the export itself
+    std::cerr << "Export failed: " << e.what() << std::endl;
+    exit(1);
+  }
+  std::cerr << "Exported " << exported << " entries." << std::endl;
+}
+
+void Epass::RunBatch(std::istream &input) {
+  std::string line;
+  std::vector<std::string> words;
+  size_t lineNumber = 0;
+  size_t staged = 0;
+  size_t written = 0;
+  size_t commits = 0;
+
+  auto fail = [&](const std::string &message) {
+    std::cout << "Line " << lineNumber << ": " << message << ".";
+    if (staged > 0) {
+      std::cout << " " << staged << (staged == 1 ? " change" : " changes")
+                << " since the last commit discarded.";
+    }
+    std::cout << std::endl;
+    exit(1);
+  };
+
+  auto commit = [&]() {
+    if (staged == 0) {
+      return;
+    }
+    try {
+      vault.Commit();
+    } catch (const std::runtime_error &e) {
+      fail(std::string("could not write file: ") + e.what());
+    }
+    written += staged;
+    staged = 0;
+    ++commits;
+  };
+
+  while (std::getline(input, line)) {
+    ++lineNumber;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    size_t first = line.find_first_not_of(" \t");
+    if (first == std::string::npos || line[first] == '#') {
       continue;
     }
-    entry.Serialize(file);
+    if (!splitWords(line, words)) {
+      fail("unterminated quote");
+    }
+    sodium_memzero(&line[0], line.size());
+
+    const std::string &command = words[0];
+    if (command == "add" && words.size() == 3) {
+      std::string &password = words[2];
+      if (words[1].empty() || words[1].size() > ENTRY_MAX_NAME ||
+          password.empty() || password.size() > ENTRY_MAX_SECRET) {
+        fail("name or password is empty or too long");
+      }
+      vault.Put(PasswordEntry(words[1], pm.encrypt(password)));
+      sodium_memzero(&password[0], password.size());
+      ++staged;
+    } else if (command == "get" && words.size() == 2) {
+      std::optional<EntryView> entry = vault.Find(words[1]);
+      if (!entry) {
+        std::cout << "No entry with name '" << words[1] << "'." << std::endl;
+        continue;
+      }
+      try {
+        if (printPassword(*entry)) {
+          ++staged;
+        }
+      } catch (const std::runtime_error &e) {
+        fail(e.what());
+      }
+    } else if (command == "delete" && words.size() == 2) {
+      if (!vault.Remove(words[1])) {
+        std::cout << "No entry with name '" << words[1] << "'." << std::endl;
+        continue;
+      }
+      ++staged;
+    } else if (command == "list" && words.size() == 1) {
+      ListEntries();
+    } else if (command == "commit" && words.size() == 1) {
+      commit();
+    } else {
+      fail("expected 'add <name> <password>', 'get <name>', "
+           "'delete <name>', 'list' or 'commit'");
+    }
+  }
+  commit();
+
+  std::cerr << "Committed " << written
+            << (written == 1 ? " change in " : " changes in ") << commits
+            << (commits == 1 ? " write." : " writes.") << std::endl;
+}
+
+void Epass::RunAgent(unsigned idleSeconds) {
+  Agent agent(vault, pm, AgentSocket());
+  try {
+    std::cout << "Agent listening on " << AgentSocket() << std::endl;
+    agent.Serve(idleSeconds);
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not start agent: " << e.what() << std::endl;
+    exit(1);
+  }
+  std::cout << "Agent locked." << std::endl;
+}
+
+void Epass::Compact(size_t shards, std::optional<Compression> compression) {
+  openVault();
+  try {
+    vault.Compact(shards, compression);
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not compact vault: " << e.what() << std::endl;
+    exit(1);
+  }
+  if (vault.ShardCount() > 1) {
+    std::cout << "Vault compacted into " << vault.ShardCount() << " shards."
+              << std::endl;
+  } else {
+    std::cout << "Vault compacted." << std::endl;
+  }
+}
+
+static std::string sealedTimeText(uint64_t time) {
+  if (time == 0) {
+    return "at an unknown time";
+  }
+  std::time_t t = static_cast<std::time_t>(time);
+  std::ostringstream text;
+  text << "on " << std::put_time(std::localtime(&t), "%Y-%m-%d %H:%M:%S");
+  return text.str();
+}
+
+// Ask which side of a conflict to keep.
+static SyncChoice askConflict(const SyncConflict &conflict) {
+  std::cout << "'" << conflict.name << "' was changed in both vaults: here "
+            << sealedTimeText(conflict.localTime) << ", there "
+            << sealedTimeText(conflict.otherTime) << "." << std::endl;
+  for (;;) {
+    std::cout << "Keep [l]ocal, [o]ther or [s]kip? " << std::flush;
+    std::string answer;
+    if (!(std::cin >> answer)) {
+      return SyncChoice::Skip;
+    }
+    if (answer == "l" || answer == "L") {
+      return SyncChoice::Local;
+    }
+    if (answer == "o" || answer == "O") {
+      return SyncChoice::Other;
+    }
+    if (answer == "s" || answer == "S") {
+      return SyncChoice::Skip;
+    }
+  }
+}
+
+void Epass::Sync(const fs::path &target, bool interactive) {
+  fs::path otherPath = fs::absolute(target);
+  std::error_code ec;
+  if (fs::is_directory(otherPath, ec)) {
+    otherPath /= VAULT_FILE;
+  }
+  if (!fs::is_directory(otherPath.parent_path(), ec)) {
+    std::cout << "No such directory: " << otherPath.parent_path().string()
+              << std::endl;
+    exit(1);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  SyncReport report;
+  try {
+    Vault other;
+    other.Open(otherPath);
+    report = syncVaults(vault, other, pm, syncStatePath(path, otherPath),
+                        interactive ? ConflictResolver(askConflict)
+                                    : ConflictResolver(lastWriterWins));
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not sync with " << otherPath.string() << ": "
+              << e.what() << std::endl;
+    exit(1);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (report.bucketsDiffering == 0) {
+    std::cout << "Already in sync with " << otherPath.string() << "."
+              << std::endl;
+    return;
+  }
+  std::cout << "Synced with " << otherPath.string() << " in "
+            << elapsed.count() << "s: compared " << report.entriesCompared
+            << " entries in " << report.bucketsDiffering << " of "
+            << DIGEST_BUCKETS << " buckets." << std::endl;
+  std::cout << "Copied " << report.copiedToLocal << " entries here and "
+            << report.copiedToOther << " there; removed "
+            << report.removedFromLocal << " here and "
+            << report.removedFromOther << " there." << std::endl;
+  if (report.conflicts > 0) {
+    std::cout << report.conflicts << " entries were changed on both sides";
+    if (report.skipped > 0) {
+      std::cout << "; " << report.skipped
+                << " were skipped and will come up again";
+    }
+    std::cout << "." << std::endl;
+  }
+}
+
+void Epass::save() {
+  try {
+    vault.Commit();
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not write file: " << e.what() << std::endl;
   }
-  file.close();
 }
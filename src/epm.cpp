@@ -0,0 +1,227 @@
+#include "epm.h"
+#include "keyfile.h"
+#include "password.h"
+#include "utils.h"
+#include "vault.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <sodium.h>
+
+// Seconds between full checks of the vault files. The commit counter is
+// checked on every call.
+#define EPM_RESCAN_INTERVAL 1
+
+struct epm_vault {
+  fs::path path;
+  Vault vault;
+  PasswordManager pm;
+  uint32_t keyId = 0;
+  bool stale = false; // the vault was found under another key
+  std::chrono::steady_clock::time_point scanned;
+};
+
+static thread_local std::string lastError;
+
+static epm_status fail(epm_status status, const std::string &message) {
+  lastError = message;
+  return status;
+}
+
+// Run fn, turning any exception into EPM_ERROR: none may cross into C.
+template <typename Fn> static epm_status guarded(const Fn &fn) {
+  lastError.clear();
+  try {
+    return fn();
+  } catch (const std::exception &e) {
+    return fail(EPM_ERROR, e.what());
+  } catch (...) {
+    return fail(EPM_ERROR, "unknown error");
+  }
+}
+
+// Make sure the entries are still encrypted with the handle's key. Once they
+// are not, every later call fails until the handle is opened again: the key
+// can neither read the vault nor write entries it could read.
+static void checkKey(epm_vault &handle) {
+  uint32_t keyId = handle.vault.KeyId();
+  if (handle.stale || (keyId != 0 && keyId != handle.keyId)) {
+    handle.stale = true;
+    throw std::runtime_error("the vault was re-encrypted with another key; "
+                             "open it again");
+  }
+}
+
+// Pick up commits and compactions made by other processes, as the agent does,
+// and check the key. Every epm process bumps the commit counter; statting
+// each file, which catches writers that do not, would cost more than the
+// lookup itself, so it is only done once per EPM_RESCAN_INTERVAL.
+static void refresh(epm_vault &handle) {
+  if (!handle.stale) {
+    auto now = std::chrono::steady_clock::now();
+    bool rescan =
+        now - handle.scanned >= std::chrono::seconds(EPM_RESCAN_INTERVAL);
+    if (rescan) {
+      handle.scanned = now;
+    }
+    if (rescan ? handle.vault.Changed() : handle.vault.CounterChanged()) {
+      handle.vault.Open(handle.path);
+    }
+  }
+  checkKey(handle);
+}
+
+// Apply change and commit it if it returns true, holding the write lock
+// throughout so that a rekey cannot land between the key check and the
+// commit. Returns what change returned.
+template <typename Fn>
+static bool writeLocked(epm_vault &handle, const Fn &change) {
+  // Taking the lock reloads the vault if another process changed it.
+  handle.vault.LockExclusive();
+  bool changed;
+  try {
+    checkKey(handle);
+    changed = change();
+    if (changed) {
+      handle.vault.Commit();
+    }
+  } catch (...) {
+    handle.vault.Unlock();
+    throw;
+  }
+  handle.vault.Unlock();
+  return changed;
+}
+
+static bool validName(const char *name) {
+  return name != nullptr && name[0] != '\0' &&
+         strnlen(name, ENTRY_MAX_NAME + 1) <= ENTRY_MAX_NAME;
+}
+
+int epm_api_version(void) { return EPM_API_VERSION; }
+
+epm_status epm_open(const char *dir, const char *master_password,
+                    epm_vault **vault) {
+  return guarded([&] {
+    if (master_password == nullptr || vault == nullptr) {
+      return fail(EPM_INVALID_ARGUMENT, "master password and handle required");
+    }
+    *vault = nullptr;
+
+    fs::path path = dir ? fs::path(dir) / VAULT_FILE : getPlatformPath();
+    if (path.empty()) {
+      return fail(EPM_ERROR, "HOME is not set and no directory was given");
+    }
+    fs::path baseDir = path.parent_path();
+    recoverRekey(baseDir, path);
+
+    SecureString secret;
+    KdfParams kdf;
+    CipherId cipher;
+    if (!readKeyFile(baseDir, secret, kdf, cipher)) {
+      return fail(EPM_NO_KEY, "no key file in " + baseDir.string());
+    }
+
+    auto handle = std::make_unique<epm_vault>();
+    handle->pm = PasswordManager(secret, cipher);
+    if (!handle->pm.VerifyKey(secret, master_password, kdf)) {
+      return fail(EPM_BAD_PASSWORD, "invalid master password");
+    }
+    handle->path = path;
+    handle->keyId = PasswordManager::KeyFingerprint(secret);
+    handle->vault.Open(path);
+    refresh(*handle);
+
+    *vault = handle.release();
+    return EPM_OK;
+  });
+}
+
+void epm_close(epm_vault *vault) {
+  if (vault != nullptr) {
+    vault->pm.wipeSecret();
+    delete vault;
+  }
+}
+
+epm_status epm_get(epm_vault *vault, const char *name, char *buffer,
+                   size_t size, size_t *length) {
+  return guarded([&] {
+    if (vault == nullptr || !validName(name) || length == nullptr ||
+        (buffer == nullptr && size > 0)) {
+      return fail(EPM_INVALID_ARGUMENT, "invalid argument to epm_get");
+    }
+    refresh(*vault);
+
+    std::optional<EntryView> entry = vault->vault.Find(name);
+    if (!entry) {
+      return fail(EPM_NOT_FOUND, std::string("no entry named ") + name);
+    }
+    bool fits = false;
+    vault->pm.withPlaintext(entry->GetPassword(),
+                            [&](std::string_view password) {
+                              *length = password.size();
+                              fits = password.size() < size;
+                              if (fits) {
+                                memcpy(buffer, password.data(),
+                                       password.size());
+                                buffer[password.size()] = '\0';
+                              }
+                            });
+    if (!fits) {
+      return fail(EPM_BUFFER_TOO_SMALL, "buffer too small for the password");
+    }
+    return EPM_OK;
+  });
+}
+
+epm_status epm_put(epm_vault *vault, const char *name, const char *password) {
+  return guarded([&] {
+    if (vault == nullptr || !validName(name) || password == nullptr ||
+        password[0] == '\0' ||
+        strnlen(password, ENTRY_MAX_SECRET + 1) > ENTRY_MAX_SECRET) {
+      return fail(EPM_INVALID_ARGUMENT,
+                  "name or password is missing, empty or too long");
+    }
+    refresh(*vault);
+    std::string sealed = vault->pm.encrypt(password);
+    writeLocked(*vault, [&] {
+      vault->vault.Put(PasswordEntry(name, sealed));
+      return true;
+    });
+    return EPM_OK;
+  });
+}
+
+epm_status epm_remove(epm_vault *vault, const char *name) {
+  return guarded([&] {
+    if (vault == nullptr || !validName(name)) {
+      return fail(EPM_INVALID_ARGUMENT, "invalid argument to epm_remove");
+    }
+    refresh(*vault);
+    if (!writeLocked(*vault, [&] { return vault->vault.Remove(name); })) {
+      return fail(EPM_NOT_FOUND, std::string("no entry named ") + name);
+    }
+    return EPM_OK;
+  });
+}
+
+epm_status epm_list(epm_vault *vault,
+                    void (*fn)(const char *name, size_t length, void *ctx),
+                    void *ctx) {
+  return guarded([&] {
+    if (vault == nullptr || fn == nullptr) {
+      return fail(EPM_INVALID_ARGUMENT, "invalid argument to epm_list");
+    }
+    refresh(*vault);
+    vault->vault.ForEachName("", [fn, ctx](std::string_view name) {
+      fn(name.data(), name.size(), ctx);
+    });
+    return EPM_OK;
+  });
+}
+
+const char *epm_last_error(void) { return lastError.c_str(); }
+
+void epm_wipe(void *p, size_t size) { sodium_memzero(p, size); }
@@ -0,0 +1,169 @@
+#include "generator.h"
+#include "cipher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sodium.h>
+#include <stdexcept>
+
+// Random bytes drawn from libsodium at once.
+#define GENERATOR_BATCH (64 * 1024)
+
+// No quotes, backslash, backtick, comma or space, so that passwords survive
+// shells and CSV files unquoted.
+#define SYMBOLS "!#$%&()*+-./:;<=>?@[]^_{|}~"
+
+static const struct {
+  unsigned bit;
+  const char *name;
+  const char *chars;
+} charClasses[] = {
+    {CLASS_LOWER, "lower", "abcdefghijklmnopqrstuvwxyz"},
+    {CLASS_UPPER, "upper", "ABCDEFGHIJKLMNOPQRSTUVWXYZ"},
+    {CLASS_DIGIT, "digit", "0123456789"},
+    {CLASS_SYMBOL, "symbol", SYMBOLS},
+};
+
+bool parseCharClasses(std::string_view list, unsigned &classes) {
+  classes = 0;
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    std::string_view word = list.substr(0, comma);
+    list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+
+    bool known = false;
+    for (const auto &c : charClasses) {
+      if (word == c.name) {
+        classes |= c.bit;
+        known = true;
+      }
+    }
+    if (!known) {
+      return false;
+    }
+  }
+  return classes != 0;
+}
+
+static std::string charsetFor(unsigned classes) {
+  std::string charset;
+  for (const auto &c : charClasses) {
+    if (classes & c.bit) {
+      charset += c.chars;
+    }
+  }
+  return charset;
+}
+
+static size_t classCount(unsigned classes) {
+  size_t count = 0;
+  for (const auto &c : charClasses) {
+    count += (classes & c.bit) != 0;
+  }
+  return count;
+}
+
+// Of all n^length strings, those missing a class are excluded. The share left
+// is at least 1 - the sum over classes of ((n - class size) / n)^length.
+static double entropyBits(unsigned classes, size_t length) {
+  double n = charsetFor(classes).size();
+  double missing = 0;
+  for (const auto &c : charClasses) {
+    if (classes & c.bit) {
+      missing += std::pow((n - strlen(c.chars)) / n, length);
+    }
+  }
+  return length * std::log2(n) + std::log2(std::max(1.0 - missing, 1e-300));
+}
+
+PasswordGenerator::PasswordGenerator(unsigned classes, size_t length)
+    : charset(charsetFor(classes)), classes(classes), length(length),
+      random(GENERATOR_BATCH) {
+  if (charset.empty() || length < classCount(classes)) {
+    throw std::runtime_error(
+        "password is too short for its character classes");
+  }
+  cryptoInit();
+
+  // Bytes below limit fall evenly on the charset.
+  size_t n = charset.size();
+  size_t limit = 256 - 256 % n;
+  memset(classOf, 0, sizeof(classOf));
+  for (const auto &c : charClasses) {
+    if (classes & c.bit) {
+      for (const char *p = c.chars; *p; ++p) {
+        classOf[static_cast<unsigned char>(*p)] = c.bit;
+      }
+    }
+  }
+  for (size_t b = 0; b < 256; ++b) {
+    table[b] = charset[b % n];
+    accept[b] = b < limit;
+  }
+  mapped.reserve(GENERATOR_BATCH);
+}
+
+double PasswordGenerator::EntropyBits() const {
+  return entropyBits(classes, length);
+}
+
+size_t PasswordGenerator::LengthFor(unsigned classes, double bits) {
+  double n = charsetFor(classes).size();
+  if (n < 2) {
+    return 0;
+  }
+  size_t length = std::max<size_t>(classCount(classes),
+                                   std::ceil(bits / std::log2(n)));
+  // Requiring every class costs a fraction of a bit on short passwords.
+  while (entropyBits(classes, length) < bits) {
+    ++length;
+  }
+  return length;
+}
+
+void PasswordGenerator::refill() {
+  randombytes_buf(random.data(), random.size());
+
+  // Unconditional store, conditional advance: the next character overwrites
+  // a rejected one.
+  mapped.resize(GENERATOR_BATCH);
+  const unsigned char *in = random.data();
+  unsigned char *out = mapped.data();
+  size_t k = 0;
+  for (size_t i = 0; i < GENERATOR_BATCH; ++i) {
+    unsigned char b = in[i];
+    out[k] = table[b];
+    k += accept[b];
+  }
+  sodium_memzero(random.data(), random.size());
+  sodium_memzero(out + k, GENERATOR_BATCH - k);
+  mapped.resize(k);
+  next = 0;
+}
+
+void PasswordGenerator::Generate(char *out) {
+  for (;;) {
+    unsigned seen = 0;
+    size_t filled = 0;
+    while (filled < length) {
+      if (next == mapped.size()) {
+        refill();
+      }
+      size_t take = std::min(length - filled, mapped.size() - next);
+      unsigned char *chars = mapped.data() + next;
+      for (size_t i = 0; i < take; ++i) {
+        seen |= classOf[chars[i]];
+      }
+      memcpy(out + filled, chars, take);
+      sodium_memzero(chars, take);
+      filled += take;
+      next += take;
+    }
+    if (seen == classes) {
+      return;
+    }
+    // Missing a class: draw a fresh password rather than patch this one,
+    // which would favour some strings over others.
+  }
+}
@@ -2,11 +2,13 @@
 
 #if defined(_WIN32) || defined(_WIN64)
 // Function that accepts the password
-std::string requestUserPassword(const std::string &prompt, char sp) {
+SecureString requestUserPassword(const std::string &prompt, char sp) {
   std::cout << prompt;
 
-  // Stores the password
-  std::string passwd = "";
+  // Stores the password; reserved so that it starts out in the arena rather
+  // than inline in the string
+  SecureString passwd;
+  passwd.reserve(64);
   char ch_ipt;
 
   // Until condition is true
@@ -45,12 +47,14 @@ std::string requestUserPassword(const std::string &prompt, char sp) {
 
 #else
 // Function that accepts the password
-std::string requestUserPassword(const std::string &prompt, char echoChar) {
+SecureString requestUserPassword(const std::string &prompt, char echoChar) {
   std::cout << prompt;
 
-  // Stores the password
-  std::string passwd = "";
-  char ch_ipt;
+  // Stores the password; reserved so that it starts out in the arena rather
+  // than inline in the string
+  SecureString passwd;
+  passwd.reserve(64);
+  int ch_ipt;
 
   // Stores the input
   struct termios old_ipt, new_ipt;
@@ -66,8 +70,8 @@ std::string requestUserPassword(const std::string &prompt, char echoChar) {
   while (true) {
     ch_ipt = getchar();
 
-    // If Enter is pressed, break the loop
-    if (ch_ipt == '\n') {
+    // If Enter is pressed or the input is closed, break the loop
+    if (ch_ipt == '\n' || ch_ipt == EOF) {
       std::cout << std::endl;
       break;
     } else if (ch_ipt == 127 && passwd.length() != 0) {
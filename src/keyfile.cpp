@@ -0,0 +1,61 @@
+#include "keyfile.h"
+#include "stats.h"
+#include "vault.h"
+
+#include <fstream>
+#include <iterator>
+
+void recoverRekey(const fs::path &baseDir, const fs::path &vaultPath) {
+  fs::path pending = baseDir / REKEY_FILE;
+  if (!fs::exists(pending)) {
+    return;
+  }
+
+  std::ifstream file(pending);
+  SecureString text((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  file.close();
+  SecureString secret;
+  KdfParams params;
+  CipherId cipher;
+  if (!parseKeyFile(text, secret, params, cipher)) {
+    secret.clear();
+  }
+
+  Vault current;
+  try {
+    current.Open(vaultPath);
+  } catch (const std::runtime_error &) {
+    return; // leave both keys alone until the vault can be read
+  }
+
+  if (!secret.empty() &&
+      current.KeyId() == PasswordManager::KeyFingerprint(secret)) {
+    fs::rename(pending, baseDir / KEY_FILE);
+  } else {
+    fs::remove(pending);
+  }
+}
+
+bool readKeyFile(const fs::path &baseDir, SecureString &secret, KdfParams &kdf,
+                 CipherId &cipher) {
+  fs::path path = baseDir / KEY_FILE;
+  if (!fs::exists(path)) {
+    return false;
+  }
+
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("could not open the key file for reading");
+  }
+  SecureString text((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  file.close();
+  stats::add(stats::BYTES_READ, text.size());
+
+  if (!parseKeyFile(text, secret, kdf, cipher)) {
+    throw std::runtime_error("the key file is corrupted or from a newer "
+                             "version");
+  }
+  return true;
+}
@@ -0,0 +1,104 @@
+#include "keyring.h"
+
+#if defined(__linux__)
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define KEY_TYPE "user"
+
+// Permission bits from keyutils.h: the possessor may view, read, update,
+// search and change the timeout. Nobody else gets anything.
+#define KEY_POS_VIEW 0x01000000
+#define KEY_POS_READ 0x02000000
+#define KEY_POS_WRITE 0x04000000
+#define KEY_POS_SEARCH 0x08000000
+#define KEY_POS_SETATTR 0x20000000
+
+static long keyctl(int op, unsigned long a2 = 0, unsigned long a3 = 0,
+                   unsigned long a4 = 0, unsigned long a5 = 0) {
+  return syscall(SYS_keyctl, op, a2, a3, a4, a5);
+}
+
+// Resolve the session keyring without creating one. A process started outside
+// a login session has none, and asking add_key for one would create a private
+// keyring that dies with the process; the kernel hands back the per-user
+// session keyring instead, which later commands can see.
+static long sessionKeyring() {
+  return keyctl(KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, 0);
+}
+
+static long findKey(const std::string &description) {
+  return keyctl(KEYCTL_SEARCH, sessionKeyring(),
+                reinterpret_cast<unsigned long>(KEY_TYPE),
+                reinterpret_cast<unsigned long>(description.c_str()), 0);
+}
+
+bool keyringStore(const std::string &description, std::string_view secret,
+                  unsigned ttlSeconds) {
+  long keyring = sessionKeyring();
+  if (keyring < 0) {
+    return false;
+  }
+
+  long id = syscall(SYS_add_key, KEY_TYPE, description.c_str(), secret.data(),
+                    secret.size(), keyring);
+  if (id < 0) {
+    return false;
+  }
+
+  keyctl(KEYCTL_SETPERM, id,
+         KEY_POS_VIEW | KEY_POS_READ | KEY_POS_WRITE | KEY_POS_SEARCH |
+             KEY_POS_SETATTR);
+
+  if (keyctl(KEYCTL_SET_TIMEOUT, id, ttlSeconds) < 0) {
+    keyctl(KEYCTL_INVALIDATE, id);
+    return false;
+  }
+  return true;
+}
+
+bool keyringLoad(const std::string &description, SecureString &secret) {
+  long id = findKey(description);
+  if (id < 0) {
+    return false;
+  }
+
+  // KEYCTL_READ returns the payload size even when the buffer is too small.
+  // The arena zeroes the buffer when it is freed.
+  std::vector<char, SecureAllocator<char>> buf(128);
+  while (true) {
+    long size = keyctl(KEYCTL_READ, id, reinterpret_cast<unsigned long>(buf.data()),
+                       buf.size());
+    if (size < 0) {
+      return false;
+    }
+    if (static_cast<size_t>(size) <= buf.size()) {
+      secret.assign(buf.data(), size);
+      return true;
+    }
+    buf.resize(size);
+  }
+}
+
+bool keyringClear(const std::string &description) {
+  long id = findKey(description);
+  if (id < 0) {
+    return false;
+  }
+  return keyctl(KEYCTL_INVALIDATE, id) == 0 ||
+         keyctl(KEYCTL_UNLINK, id, sessionKeyring()) == 0;
+}
+
+#else
+
+bool keyringStore(const std::string &, std::string_view, unsigned) {
+  return false;
+}
+
+bool keyringLoad(const std::string &, SecureString &) { return false; }
+
+bool keyringClear(const std::string &) { return false; }
+
+#endif
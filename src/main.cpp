@@ -1,13 +1,39 @@
+#include "agent.h"
 #include "epass.h"
+#include "stats.h"
 
-static std::string subcommands[] = {"keygen", "add",    "get",
-                                    "list",   "delete", "help"};
+static std::string subcommands[] = {
+    "keygen", "add",   "get",    "list",  "search", "complete", "delete",
+    "import", "export", "batch", "gen",   "agent",  "unlock",   "lock",
+    "rekey",  "compact", "sync",     "help"};
 
 static void printHelp();
+static int handleKeygen(int argc, char **argv, Epass &epass);
 static int handleAdd(int argc, char **argv, Epass &epass);
+static int handleSync(int argc, char **argv, Epass &epass);
 static int handleGet(int argc, char **argv, Epass &epass);
+static int handleImport(int argc, char **argv, Epass &epass);
+static int handleBatch(int argc, char **argv, Epass &epass);
+static int handleExport(int argc, char **argv, Epass &epass);
+static int handleAgent(int argc, char **argv, Epass &epass);
+static int handleUnlock(int argc, char **argv, Epass &epass);
+static int handleSearch(int argc, char **argv, Epass &epass);
+static int handleGen(int argc, char **argv, Epass &epass);
+static int handleCompact(int argc, char **argv, Epass &epass);
+static int forwardToAgent(int argc, char **argv, Epass &epass);
 
 int main(int argc, char **argv) {
+  // Global options come before the subcommand.
+  stats::enableFromEnvironment();
+  while (argc >= 2 && (strcmp(argv[1], "--stats") == 0 ||
+                       strcmp(argv[1], "--stats=json") == 0)) {
+    stats::enable(strcmp(argv[1], "--stats") == 0 ? stats::Format::Text
+                                                   : stats::Format::Json);
+    argv[1] = argv[0];
+    ++argv;
+    --argc;
+  }
+
   // Handle HELP
   if (argc < 2 || strcmp(argv[1], "help") == 0 ||
       strcmp(argv[1], "--help") == 0) {
@@ -15,16 +41,92 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // Every secret a command allocates is wiped in one pass when it returns.
+  // The scope is declared first so that it ends after everything in it.
+  SecureArena::Scope secrets;
+
   // Initialise an Epass instance
   Epass epass;
 
   // Handle key generation before calling Load.
   // Load will check for secret key and initialize PasswordManager or fail.
   if (strcmp(argv[1], "keygen") == 0) {
-    epass.GenerateKey();
+    return handleKeygen(argc, argv, epass);
+  }
+
+  // Compaction only moves ciphertext around and needs no key.
+  if (strcmp(argv[1], "compact") == 0) {
+    return handleCompact(argc, argv, epass);
+  }
+
+  // Names are stored in the clear; searching and completing skip the KDF.
+  if (strcmp(argv[1], "search") == 0) {
+    return handleSearch(argc, argv, epass);
+  }
+
+  // Generated passwords are only encrypted when they are stored.
+  if (strcmp(argv[1], "gen") == 0) {
+    return handleGen(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "complete") == 0) {
+    epass.CompleteNames(argc >= 3 ? argv[2] : "");
+    return 0;
+  }
+
+  if (strcmp(argv[1], "agent") == 0) {
+    return handleAgent(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "rekey") == 0) {
+    epass.Rekey();
     return 0;
   }
 
+  if (strcmp(argv[1], "unlock") == 0) {
+    return handleUnlock(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "lock") == 0) {
+    SecureString reply;
+    bool agent = agentRequest(epass.AgentSocket(), {"lock"}, reply);
+    bool cached = epass.Lock();
+    if (agent) {
+      std::cout << "Agent locked." << std::endl;
+    }
+    if (cached) {
+      std::cout << "Cached key removed." << std::endl;
+    }
+    if (!agent && !cached) {
+      std::cout << "Nothing to lock." << std::endl;
+    }
+    return 0;
+  }
+
+  // A running agent answers without a password prompt or vault load.
+  int agentStatus = forwardToAgent(argc, argv, epass);
+  if (agentStatus >= 0) {
+    return agentStatus;
+  }
+
+  // Import and batch open their input before prompting for the master
+  // password.
+  if (strcmp(argv[1], "import") == 0) {
+    return handleImport(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "batch") == 0) {
+    return handleBatch(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "export") == 0) {
+    return handleExport(argc, argv, epass);
+  }
+
+  if (strcmp(argv[1], "sync") == 0) {
+    return handleSync(argc, argv, epass);
+  }
+
   // will exit with code 1 if key does not exist
   epass.Init();
 
@@ -46,19 +148,40 @@ int main(int argc, char **argv) {
   return 0;
 }
 
+static int handleKeygen(int argc, char **argv, Epass &epass) {
+  unsigned targetMs = 0;
+  if (argc >= 4 && strcmp(argv[2], "--target-ms") == 0) {
+    targetMs = std::strtoul(argv[3], nullptr, 10);
+    if (targetMs == 0) {
+      std::cout << "Target must be a positive number of milliseconds."
+                << std::endl;
+      return 1;
+    }
+  } else if (argc != 2) {
+    std::cout << "Usage: " << argv[0] << " keygen [--target-ms <milliseconds>]"
+              << std::endl;
+    return 1;
+  }
+
+  epass.GenerateKey(targetMs);
+  return 0;
+}
+
 static int handleAdd(int argc, char **argv, Epass &epass) {
   if (argc < 4) {
     std::cout << "Usage: " << argv[0] << " add <name> <password>" << std::endl;
     return 1;
   }
 
-  if (strlen(argv[2]) > 64) {
-    std::cout << "Name cannot be longer than 64 characters." << std::endl;
+  if (strlen(argv[2]) > ENTRY_MAX_NAME) {
+    std::cout << "Name cannot be longer than " << ENTRY_MAX_NAME
+              << " characters." << std::endl;
     return 1;
   }
 
-  if (strlen(argv[3]) > 128) {
-    std::cout << "Password cannot be longer than 128 characters." << std::endl;
+  if (strlen(argv[3]) > ENTRY_MAX_SECRET) {
+    std::cout << "Password cannot be longer than " << ENTRY_MAX_SECRET
+              << " characters." << std::endl;
     return 1;
   }
 
@@ -82,7 +205,11 @@ static int handleAdd(int argc, char **argv, Epass &epass) {
 
 static void printHelp() {
   // print extended help
-  std::cout << "Usage: epm <subcommand> [arguments]" << std::endl;
+  std::cout << "Usage: epm [--stats[=json]] <subcommand> [arguments]"
+            << std::endl;
+  std::cout << "  --stats prints phase timings and counters to stderr on exit "
+               "(also EPM_TRACE=1|json)."
+            << std::endl;
   std::cout << "Subcommands: " << std::endl;
   for (auto &subcommand : subcommands) {
     std::cout << "  " << subcommand << std::endl;
@@ -95,13 +222,122 @@ static void printHelp() {
       std::cout << "    Usage: epm get <name>" << std::endl;
     } else if (subcommand == "list") {
       std::cout << "    List all entries in the password store." << std::endl;
+    } else if (subcommand == "search") {
+      std::cout << "    List names that fuzzy-match a query, best match first."
+                << std::endl;
+      std::cout << "    Usage: epm search <query> [--limit <n>] (default 20)"
+                << std::endl;
+    } else if (subcommand == "complete") {
+      std::cout << "    Print the names starting with a prefix, for shell "
+                   "completion."
+                << std::endl;
+      std::cout << "    Usage: epm complete [<prefix>]" << std::endl;
+    } else if (subcommand == "gen") {
+      std::cout << "    Generate random passwords, one per line, or store them "
+                   "with one write under names where {n} counts from 1."
+                << std::endl;
+      std::cout << "    Usage: epm gen [<count>] [--length <n>] (default 20) "
+                   "[--entropy <bits>] [--classes lower,upper,digit,symbol] "
+                   "[--store <name-{n}>]"
+                << std::endl;
     } else if (subcommand == "delete") {
       std::cout << "    Delete an entry from the password store." << std::endl;
       std::cout << "    Flags: epm delete <name>" << std::endl;
+    } else if (subcommand == "import") {
+      std::cout << "    Import entries from a CSV (name,password) or JSON lines"
+                << std::endl;
+      std::cout << "    ({\"name\": ..., \"password\": ...}) file or stdin."
+                << std::endl;
+      std::cout << "    Usage: epm import [--format csv|jsonl] [<file>|-]"
+                << std::endl;
+    } else if (subcommand == "export") {
+      std::cout << "    Write every entry with its decrypted password as CSV "
+                   "or JSON lines"
+                << std::endl;
+      std::cout << "    to a file or stdout, in a form 'epm import' reads "
+                   "back."
+                << std::endl;
+      std::cout << "    Usage: epm export [--format csv|jsonl] [<file>|-]"
+                << std::endl;
+    } else if (subcommand == "batch") {
+      std::cout << "    Run add, get, delete and list commands from a file or "
+                   "stdin, one"
+                << std::endl;
+      std::cout << "    per line, with one unlock. Changes are written "
+                   "together at each"
+                << std::endl;
+      std::cout << "    'commit' line and at the end. An invalid line stops "
+                   "the batch"
+                << std::endl;
+      std::cout << "    and discards the changes since the last commit."
+                << std::endl;
+      std::cout << "    Usage: epm batch [<file>|-]" << std::endl;
+    } else if (subcommand == "agent") {
+      std::cout << "    Unlock once and serve get, list and add from memory."
+                << std::endl;
+      std::cout << "    Locks after --idle seconds without requests (default "
+                   "900)."
+                << std::endl;
+      std::cout << "    Usage: epm agent [--idle <seconds>]" << std::endl;
+    } else if (subcommand == "unlock") {
+      std::cout << "    Cache the key in the session keyring so that commands "
+                   "in the"
+                << std::endl;
+      std::cout << "    next --ttl seconds (default 300) skip the password "
+                   "prompt."
+                << std::endl;
+      std::cout << "    Usage: epm unlock [--ttl <seconds>]" << std::endl;
+    } else if (subcommand == "lock") {
+      std::cout << "    Lock a running agent and drop the cached key."
+                << std::endl;
+    } else if (subcommand == "rekey") {
+      std::cout << "    Change the master password and re-encrypt every entry "
+                   "with the"
+                << std::endl;
+      std::cout << "    new key." << std::endl;
+    } else if (subcommand == "compact") {
+      std::cout << "    Rewrite the password store and drop its change log."
+                << std::endl;
+      std::cout << "    --shards splits it into that many shard files (1: a "
+                   "single file)."
+                << std::endl;
+      std::cout << "    --compress stores records in zlib blocks of "
+                   "--block-size KiB"
+                << std::endl;
+      std::cout << "    (default 16) at --level 1-9 (default 6); --level 0 "
+                   "stores them"
+                << std::endl;
+      std::cout << "    uncompressed again." << std::endl;
+      std::cout << "    Usage: epm compact [--shards <n>] [--compress] "
+                   "[--level <n>]"
+                << std::endl;
+      std::cout << "                       [--block-size <KiB>]" << std::endl;
+    } else if (subcommand == "sync") {
+      std::cout << "    Merge the password store with another copy of it, "
+                   "e.g. on a shared"
+                << std::endl;
+      std::cout << "    drive, so that both hold the same entries. Only the "
+                   "entries that"
+                << std::endl;
+      std::cout << "    differ are read and written. An entry changed in both "
+                   "goes to the"
+                << std::endl;
+      std::cout << "    version written last, or --interactive asks which to "
+                   "keep."
+                << std::endl;
+      std::cout << "    Usage: epm sync <vault-file-or-directory> "
+                   "[--interactive]"
+                << std::endl;
     } else if (subcommand == "help") {
       std::cout << "    Print this help message." << std::endl;
     } else if (subcommand == "keygen") {
-      std::cout << "    Generate an encryption key." << std::endl;
+      std::cout << "    Generate an encryption key. --target-ms tunes the key "
+                   "derivation"
+                << std::endl;
+      std::cout << "    to take about that long to unlock on this machine."
+                << std::endl;
+      std::cout << "    Usage: epm keygen [--target-ms <milliseconds>]"
+                << std::endl;
     }
   }
 }
@@ -115,4 +351,371 @@ static int handleGet(int argc, char **argv, Epass &epass) {
   std::string name{argv[2]};
   epass.PrintRawEntry(name);
   return 0;
-}
\ No newline at end of file
+}
+
+static int handleImport(int argc, char **argv, Epass &epass) {
+  std::string source = "-";
+  RecordFormat format = RecordFormat::CSV;
+  bool formatGiven = false;
+
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      if (!parseRecordFormat(argv[++i], format)) {
+        std::cout << "Unknown format '" << argv[i] << "'." << std::endl;
+        return 1;
+      }
+      formatGiven = true;
+    } else {
+      source = argv[i];
+    }
+  }
+
+  if (!formatGiven) {
+    std::string ext = fs::path(source).extension().string();
+    if (ext == ".jsonl" || ext == ".json") {
+      format = RecordFormat::JSONL;
+    }
+  }
+
+  std::ifstream file;
+  if (source != "-") {
+    file.open(source, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Could not open " << source << " for reading." << std::endl;
+      return 1;
+    }
+  }
+
+  // When reading from stdin the master password is the first line.
+  epass.Init();
+  epass.ImportEntries(source == "-" ? std::cin : file, format);
+  return 0;
+}
+
+static int handleAgent(int argc, char **argv, Epass &epass) {
+  unsigned long idleSeconds = 900;
+  if (argc >= 4 && strcmp(argv[2], "--idle") == 0) {
+    char *end;
+    errno = 0;
+    idleSeconds = std::strtoul(argv[3], &end, 10);
+    if (!isdigit(static_cast<unsigned char>(argv[3][0])) || *end != '\0' ||
+        errno == ERANGE || idleSeconds == 0 ||
+        idleSeconds > AGENT_MAX_IDLE) {
+      std::cout << "--idle must be between 1 and " << AGENT_MAX_IDLE
+                << " seconds." << std::endl;
+      return 1;
+    }
+  } else if (argc != 2) {
+    std::cout << "Usage: " << argv[0] << " agent [--idle <seconds>]"
+              << std::endl;
+    return 1;
+  }
+
+  epass.Init();
+  epass.RunAgent(idleSeconds);
+  return 0;
+}
+
+// Returns the exit status of a request answered by the agent, or -1 if the
+// command has to run locally.
+static int forwardToAgent(int argc, char **argv, Epass &epass) {
+  std::vector<std::string> request;
+  std::string subcommand{argv[1]};
+  if (subcommand == "get" && argc >= 3) {
+    request = {"get", argv[2]};
+  } else if (subcommand == "list") {
+    request = {"list"};
+  } else if (subcommand == "add" && argc >= 4) {
+    request = {"add", argv[2], argv[3]};
+  } else {
+    return -1;
+  }
+
+  SecureString reply;
+  if (!agentRequest(epass.AgentSocket(), request, reply)) {
+    return -1;
+  }
+
+  std::string_view body = std::string_view(reply).substr(1);
+  if (reply[0] == AGENT_ERROR) {
+    std::cout << body << std::endl;
+    return 1;
+  }
+
+  if (subcommand == "get" && reply[0] == AGENT_OK) {
+    std::cout << request[1] << std::endl;
+    std::cout << body << std::endl;
+  } else if (subcommand == "list") {
+    size_t begin = 1;
+    size_t count = 0;
+    for (size_t i = 1; i < reply.size(); ++i) {
+      if (reply[i] == '\0') {
+        std::cout << std::string_view(reply).substr(begin, i - begin)
+                  << std::endl;
+        std::cout << "-------------------------" << std::endl;
+        begin = i + 1;
+        ++count;
+      }
+    }
+    if (count == 0) {
+      std::cout << "No entries." << std::endl;
+    }
+  }
+  return 0;
+}
+
+static int handleUnlock(int argc, char **argv, Epass &epass) {
+  unsigned ttl = 300;
+  if (argc >= 4 && strcmp(argv[2], "--ttl") == 0) {
+    ttl = std::strtoul(argv[3], nullptr, 10);
+  } else if (argc != 2) {
+    std::cout << "Usage: " << argv[0] << " unlock [--ttl <seconds>]"
+              << std::endl;
+    return 1;
+  }
+
+  if (ttl == 0) {
+    std::cout << "TTL must be a positive number of seconds." << std::endl;
+    return 1;
+  }
+
+  epass.Init(ttl);
+  std::cout << "Unlocked for " << ttl << " seconds." << std::endl;
+  return 0;
+}
+
+static int handleSearch(int argc, char **argv, Epass &epass) {
+  std::string query;
+  size_t limit = 20;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+      limit = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      query = argv[i];
+    }
+  }
+
+  if (query.empty() || limit == 0) {
+    std::cout << "Usage: " << argv[0] << " search <query> [--limit <n>]"
+              << std::endl;
+    return 1;
+  }
+
+  epass.SearchEntries(query, limit);
+  return 0;
+}
+
+static int handleGen(int argc, char **argv, Epass &epass) {
+  size_t count = 1;
+  size_t length = 20;
+  double entropy = 0;
+  unsigned classes = CLASS_ALL;
+  std::string pattern;
+  bool usage = false;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+      length = std::strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--entropy") == 0 && i + 1 < argc) {
+      entropy = std::strtod(argv[++i], nullptr);
+      usage |= entropy <= 0;
+    } else if (strcmp(argv[i], "--classes") == 0 && i + 1 < argc) {
+      usage |= !parseCharClasses(argv[++i], classes);
+    } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+      pattern = argv[++i];
+    } else if (argv[i][0] != '-') {
+      count = std::strtoul(argv[i], nullptr, 10);
+    } else {
+      usage = true;
+    }
+  }
+
+  // An entropy target lengthens passwords that would fall short of it.
+  if (entropy > 0) {
+    length = std::max(length, PasswordGenerator::LengthFor(classes, entropy));
+  }
+
+  if (usage || count == 0 || length == 0) {
+    std::cout << "Usage: " << argv[0]
+              << " gen [<count>] [--length <n>] [--entropy <bits>] "
+                 "[--classes lower,upper,digit,symbol] [--store <name-{n}>]"
+              << std::endl;
+    return 1;
+  }
+  if (length > ENTRY_MAX_SECRET) {
+    std::cout << "Password cannot be longer than " << ENTRY_MAX_SECRET
+              << " characters." << std::endl;
+    return 1;
+  }
+  if (!pattern.empty() && count > 1 &&
+      pattern.find("{n}") == std::string::npos) {
+    std::cout << "The name pattern must contain {n} to store more than one "
+                 "password."
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    PasswordGenerator generator(classes, length);
+    if (pattern.empty()) {
+      epass.PrintGenerated(std::cout, count, generator);
+    } else {
+      epass.Init();
+      epass.StoreGenerated(pattern, count, generator);
+    }
+  } catch (const std::runtime_error &e) {
+    std::cout << "Could not generate passwords: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+static int handleCompact(int argc, char **argv, Epass &epass) {
+  size_t shards = 0;
+  // Any compression option switches it on, at zlib's default level unless
+  // --level says otherwise.
+  Compression compression;
+  compression.level = 6;
+  bool compress = false;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      shards = std::strtoul(argv[++i], nullptr, 10);
+      if (shards == 0 || shards > 4096) {
+        std::cout << "--shards must be between 1 and 4096" << std::endl;
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      compress = true;
+    } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+      char *end;
+      unsigned long level = std::strtoul(argv[++i], &end, 10);
+      if (*end != '\0' || level > 9) {
+        std::cout << "--level must be between 0 and 9" << std::endl;
+        return 1;
+      }
+      compression.level = level;
+      compress = true;
+    } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+      unsigned long kib = std::strtoul(argv[++i], nullptr, 10);
+      if (kib == 0 || kib > 16384) {
+        std::cout << "--block-size must be between 1 and 16384 KiB"
+                  << std::endl;
+        return 1;
+      }
+      compression.blockSize = kib * 1024;
+      compress = true;
+    } else {
+      std::cout << "Usage: " << argv[0]
+                << " compact [--shards <n>] [--compress] [--level <n>] "
+                   "[--block-size <KiB>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  if (compress) {
+    epass.Compact(shards, compression);
+  } else {
+    epass.Compact(shards);
+  }
+  return 0;
+}
+
+static int handleBatch(int argc, char **argv, Epass &epass) {
+  if (argc > 3) {
+    std::cout << "Usage: " << argv[0] << " batch [<file>|-]" << std::endl;
+    return 1;
+  }
+  std::string source = argc == 3 ? argv[2] : "-";
+
+  std::ifstream file;
+  if (source != "-") {
+    file.open(source, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Could not open " << source << " for reading." << std::endl;
+      return 1;
+    }
+  }
+
+  // When reading from stdin the master password is the first line.
+  epass.Init();
+  epass.RunBatch(source == "-" ? std::cin : file);
+  return 0;
+}
+
+static int handleExport(int argc, char **argv, Epass &epass) {
+  std::string target = "-";
+  RecordFormat format = RecordFormat::CSV;
+  bool formatGiven = false;
+
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      if (!parseRecordFormat(argv[++i], format)) {
+        std::cout << "Unknown format '" << argv[i] << "'." << std::endl;
+        return 1;
+      }
+      formatGiven = true;
+    } else {
+      target = argv[i];
+    }
+  }
+
+  if (!formatGiven) {
+    std::string ext = fs::path(target).extension().string();
+    if (ext == ".jsonl" || ext == ".json") {
+      format = RecordFormat::JSONL;
+    }
+  }
+
+  // Keep the password prompt off stdout when stdout carries the export.
+  std::streambuf *stdoutBuffer = std::cout.rdbuf();
+  if (target == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+  // Unlock first, so that a wrong password leaves an existing file alone.
+  epass.Init();
+  std::cout.rdbuf(stdoutBuffer);
+
+  std::ofstream file;
+  if (target != "-") {
+    // The export holds every password in the clear, so the file is private
+    // from the moment it exists.
+    try {
+      createPrivateFile(target);
+    } catch (const std::runtime_error &e) {
+      std::cout << "Could not open " << target << " for writing: " << e.what()
+                << std::endl;
+      return 1;
+    }
+    file.open(target, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Could not open " << target << " for writing." << std::endl;
+      return 1;
+    }
+  }
+
+  epass.ExportEntries(target == "-" ? std::cout : file, format);
+  return 0;
+}
+
+static int handleSync(int argc, char **argv, Epass &epass) {
+  std::string target;
+  bool interactive = false;
+
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--interactive") == 0) {
+      interactive = true;
+    } else {
+      target = argv[i];
+    }
+  }
+
+  if (target.empty()) {
+    std::cout << "Usage: epm sync <vault-file-or-directory> [--interactive]"
+              << std::endl;
+    return 1;
+  }
+
+  epass.Init();
+  epass.Sync(target, interactive);
+  return 0;
+}
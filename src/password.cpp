@@ -1,45 +1,90 @@
 #include "password.h"
 
-PasswordEntry::PasswordEntry() noexcept {
-  memset(name, 0, sizeof(name));
-  memset(password, 0, sizeof(password));
+PasswordEntry::PasswordEntry(const std::string &name,
+                             const std::string &password)
+    : name(name), password(password) {}
+
+PasswordEntry::PasswordEntry(const EntryView &view)
+    : name(view.GetName()), password(view.GetPassword()) {}
+
+EntryView::EntryView(const PasswordEntry &entry) noexcept
+    : name(entry.GetName()), password(entry.GetPassword()) {}
+
+void PasswordEntry::SetPassword(const std::string &password) {
+  this->password = password;
 }
 
-PasswordEntry::PasswordEntry(const std::string &name,
-                             const std::string &password) noexcept {
-  SetName(name);
-  SetPassword(password);
+void PasswordEntry::SetName(const std::string &name) { this->name = name; }
+
+void putVarint(std::string &output, uint64_t value) {
+  while (value >= 0x80) {
+    output += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  output += static_cast<char>(value);
 }
 
-void PasswordEntry::SetPassword(const std::string &password) {
-  memset(this->password, 0, sizeof(this->password));
-  if (password.size() <= sizeof(this->password)) {
-    memcpy(this->password, password.c_str(), password.size());
-  } else {
-    std::cerr << "Password size exceeds the maximum allowed size." << std::endl;
+bool getVarint(const char *&input, const char *end, uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && input < end; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*input++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
   }
+  return false;
+}
+
+// Serialize an entry to binary format
+void EntryView::Serialize(std::string &output) const {
+  putVarint(output, name.size());
+  putVarint(output, password.size());
+  output.append(name);
+  output.append(password);
 }
 
-void PasswordEntry::SetName(const std::string &name) {
-  memset(this->name, 0, sizeof(this->name));
-  if (name.size() <= sizeof(this->name)) {
-    memcpy(this->name, name.c_str(), name.size());
-  } else {
-    std::cerr << "Name size exceeds the maximum allowed size." << std::endl;
+// Point at an entry in binary format without copying it
+bool EntryView::Deserialize(const char *&input, const char *end) {
+  uint64_t nameSize;
+  uint64_t passwordSize;
+  if (!getVarint(input, end, nameSize) ||
+      !getVarint(input, end, passwordSize) || nameSize > ENTRY_MAX_NAME ||
+      passwordSize > ENTRY_MAX_PASSWORD ||
+      nameSize + passwordSize > static_cast<uint64_t>(end - input)) {
+    return false;
   }
+
+  name = std::string_view(input, nameSize);
+  input += nameSize;
+  password = std::string_view(input, passwordSize);
+  input += passwordSize;
+  return true;
 }
 
-// Serialize a PasswordEntry to binary format
-void PasswordEntry::Serialize(std::ostream &output) const {
-  output.write(name, sizeof(name));
-  output.write(password, sizeof(password));
+void EntryView::DeserializeFixed(const char *input) {
+  name = std::string_view(input, strnlen(input, FIXED_NAME_SIZE));
+  input += FIXED_NAME_SIZE;
+  password = std::string_view(input, strnlen(input, FIXED_PASSWORD_SIZE));
 }
 
-// Deserialize a PasswordEntry from binary format
-void PasswordEntry::Deserialize(std::istream &input) {
-  input.read(name, sizeof(name));
-  input.read(password, sizeof(password));
+void PasswordEntry::Serialize(std::string &output) const {
+  EntryView(*this).Serialize(output);
 }
 
-std::string PasswordEntry::GetName() const { return std::string(name); }
-std::string PasswordEntry::GetPassword() const { return std::string(password); }
+bool PasswordEntry::Deserialize(const char *&input, const char *end) {
+  EntryView view;
+  if (!view.Deserialize(input, end)) {
+    return false;
+  }
+  name.assign(view.GetName());
+  password.assign(view.GetPassword());
+  return true;
+}
+
+void PasswordEntry::DeserializeFixed(const char *input) {
+  EntryView view;
+  view.DeserializeFixed(input);
+  name.assign(view.GetName());
+  password.assign(view.GetPassword());
+}
@@ -0,0 +1,429 @@
+#include "records.h"
+
+#include <algorithm>
+#include <sodium.h>
+#include <stdexcept>
+#include <vector>
+
+// RecordWriter hands its buffer to the stream once it holds this many bytes.
+#define RECORD_BUFFER_SIZE 65536
+
+bool parseRecordFormat(const std::string &name, RecordFormat &format) {
+  if (name == "csv") {
+    format = RecordFormat::CSV;
+  } else if (name == "jsonl" || name == "json") {
+    format = RecordFormat::JSONL;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+RecordReader::RecordReader(std::istream &input, RecordFormat format)
+    : input(input), format(format) {}
+
+bool RecordReader::Next(Credential &record) {
+  return format == RecordFormat::CSV ? nextCSV(record) : nextJSON(record);
+}
+
+static std::runtime_error parseError(size_t line, const std::string &what) {
+  return std::runtime_error("line " + std::to_string(line) + ": " + what);
+}
+
+static bool equalsIgnoreCase(std::string_view a, const char *b) {
+  std::string lower(a);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  return lower == b;
+}
+
+bool RecordReader::nextCSV(Credential &record) {
+  std::streambuf *buf = input.rdbuf();
+  typedef std::char_traits<char> traits;
+
+  while (true) {
+    SecureStrings fields(1);
+    bool quoted = false;
+    bool any = false;
+    line = nextLine;
+
+    while (true) {
+      int c = buf->sbumpc();
+      if (c == traits::eof()) {
+        if (quoted) {
+          throw parseError(line, "unterminated quoted field");
+        }
+        if (!any) {
+          return false;
+        }
+        break;
+      }
+      any = true;
+
+      if (quoted) {
+        if (c == '"') {
+          if (buf->sgetc() == '"') {
+            fields.back() += '"';
+            buf->sbumpc();
+          } else {
+            quoted = false;
+          }
+        } else {
+          if (c == '\n') {
+            ++nextLine;
+          }
+          fields.back() += static_cast<char>(c);
+        }
+      } else if (c == ',') {
+        fields.emplace_back();
+      } else if (c == '"' && fields.back().empty()) {
+        quoted = true;
+      } else if (c == '\r' && buf->sgetc() == '\n') {
+        continue;
+      } else if (c == '\n') {
+        ++nextLine;
+        break;
+      } else {
+        fields.back() += static_cast<char>(c);
+      }
+    }
+
+    // Blank line
+    if (fields.size() == 1 && fields[0].empty()) {
+      continue;
+    }
+
+    if (fields.size() != 2) {
+      throw parseError(line, "expected 2 fields, got " +
+                                 std::to_string(fields.size()));
+    }
+
+    bool header = first && equalsIgnoreCase(fields[0], "name") &&
+                  equalsIgnoreCase(fields[1], "password");
+    first = false;
+    if (header) {
+      continue;
+    }
+
+    record.name.assign(fields[0].data(), fields[0].size());
+    record.password = std::move(fields[1]);
+    return true;
+  }
+}
+
+static void skipSpace(std::string_view s, size_t &i) {
+  while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r')) {
+    ++i;
+  }
+}
+
+static void appendUTF8(SecureString &out, uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+static uint32_t parseHex4(std::string_view s, size_t i, size_t line) {
+  if (i + 4 > s.size()) {
+    throw parseError(line, "truncated \\u escape");
+  }
+  uint32_t value = 0;
+  for (size_t k = i; k < i + 4; ++k) {
+    char c = s[k];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      throw parseError(line, "invalid \\u escape");
+    }
+  }
+  return value;
+}
+
+static SecureString parseString(std::string_view s, size_t &i, size_t line) {
+  if (i >= s.size() || s[i] != '"') {
+    throw parseError(line, "expected string");
+  }
+  ++i;
+
+  SecureString out;
+  while (true) {
+    if (i >= s.size()) {
+      throw parseError(line, "unterminated string");
+    }
+    char c = s[i++];
+    if (c == '"') {
+      return out;
+    }
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (i >= s.size()) {
+      throw parseError(line, "unterminated string");
+    }
+    char e = s[i++];
+    switch (e) {
+    case '"':
+    case '\\':
+    case '/':
+      out += e;
+      break;
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'n':
+      out += '\n';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'u': {
+      uint32_t cp = parseHex4(s, i, line);
+      i += 4;
+      if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 <= s.size() && s[i] == '\\' &&
+          s[i + 1] == 'u') {
+        uint32_t low = parseHex4(s, i + 2, line);
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          i += 6;
+        }
+      }
+      appendUTF8(out, cp);
+      break;
+    }
+    default:
+      throw parseError(line, std::string("invalid escape \\") + e);
+    }
+  }
+}
+
+// Skip a scalar value we do not care about (number, true, false, null).
+static void skipScalar(std::string_view s, size_t &i, size_t line) {
+  size_t start = i;
+  while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ' ' &&
+         s[i] != '\t') {
+    if (s[i] == '{' || s[i] == '[') {
+      throw parseError(line, "nested values are not supported");
+    }
+    ++i;
+  }
+  if (i == start) {
+    throw parseError(line, "expected value");
+  }
+}
+
+bool RecordReader::nextJSON(Credential &record) {
+  SecureString text;
+  while (std::getline(input, text)) {
+    line = nextLine++;
+
+    size_t i = 0;
+    skipSpace(text, i);
+    if (i == text.size()) {
+      continue;
+    }
+
+    if (text[i++] != '{') {
+      throw parseError(line, "expected object");
+    }
+
+    bool hasName = false;
+    bool hasPassword = false;
+    skipSpace(text, i);
+    if (i < text.size() && text[i] == '}') {
+      ++i;
+    } else {
+      while (true) {
+        skipSpace(text, i);
+        SecureString key = parseString(text, i, line);
+        skipSpace(text, i);
+        if (i >= text.size() || text[i++] != ':') {
+          throw parseError(line, "expected ':'");
+        }
+        skipSpace(text, i);
+
+        if (key == "name" || key == "password") {
+          SecureString value = parseString(text, i, line);
+          if (key == "name") {
+            record.name.assign(value.data(), value.size());
+            hasName = true;
+          } else {
+            record.password = std::move(value);
+            hasPassword = true;
+          }
+        } else if (i < text.size() && text[i] == '"') {
+          parseString(text, i, line);
+        } else {
+          skipScalar(text, i, line);
+        }
+
+        skipSpace(text, i);
+        if (i < text.size() && text[i] == ',') {
+          ++i;
+          continue;
+        }
+        if (i < text.size() && text[i] == '}') {
+          ++i;
+          break;
+        }
+        throw parseError(line, "expected ',' or '}'");
+      }
+    }
+
+    skipSpace(text, i);
+    if (i != text.size()) {
+      throw parseError(line, "trailing characters after object");
+    }
+    if (!hasName || !hasPassword) {
+      throw parseError(line, "object needs \"name\" and \"password\"");
+    }
+    return true;
+  }
+  return false;
+}
+
+RecordWriter::RecordWriter(std::ostream &output, RecordFormat format)
+    : output(output), format(format) {
+  buffer.reserve(RECORD_BUFFER_SIZE + 1024);
+  if (format == RecordFormat::CSV) {
+    buffer += "name,password\n";
+  }
+}
+
+void RecordWriter::Write(std::string_view name, std::string_view password) {
+  if (format == RecordFormat::CSV) {
+    appendCSV(name);
+    buffer += ',';
+    appendCSV(password);
+    buffer += '\n';
+  } else {
+    buffer += "{\"name\": ";
+    appendJSON(name);
+    buffer += ", \"password\": ";
+    appendJSON(password);
+    buffer += "}\n";
+  }
+
+  if (buffer.size() >= RECORD_BUFFER_SIZE) {
+    Flush();
+  }
+}
+
+void RecordWriter::Flush() {
+  output.write(buffer.data(), buffer.size());
+  output.flush();
+  sodium_memzero(&buffer[0], buffer.size());
+  buffer.clear();
+  if (!output) {
+    throw std::runtime_error("write failed");
+  }
+}
+
+void RecordWriter::appendCSV(std::string_view field) {
+  if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+    buffer += field;
+    return;
+  }
+  buffer += '"';
+  for (char c : field) {
+    if (c == '"') {
+      buffer += '"';
+    }
+    buffer += c;
+  }
+  buffer += '"';
+}
+
+void RecordWriter::appendJSON(std::string_view value) {
+  static const char hex[] = "0123456789abcdef";
+  buffer += '"';
+  for (char c : value) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      buffer += '\\';
+      buffer += c;
+    } else if (c == '\n') {
+      buffer += "\\n";
+    } else if (c == '\t') {
+      buffer += "\\t";
+    } else if (c == '\r') {
+      buffer += "\\r";
+    } else if (u < 0x20) {
+      buffer += "\\u00";
+      buffer += hex[u >> 4];
+      buffer += hex[u & 0xf];
+    } else {
+      buffer += c;
+    }
+  }
+  buffer += '"';
+}
+
+bool splitWords(const std::string &line, std::vector<std::string> &words) {
+  words.clear();
+  std::string word;
+  bool inWord = false;
+  char quote = 0;
+
+  for (size_t i = 0; i < line.size(); ++i) {
+    char c = line[i];
+    if (quote == '\'') {
+      if (c == '\'') {
+        quote = 0;
+      } else {
+        word += c;
+      }
+    } else if (quote == '"') {
+      if (c == '"') {
+        quote = 0;
+      } else if (c == '\\' && i + 1 < line.size() &&
+                 (line[i + 1] == '"' || line[i + 1] == '\\')) {
+        word += line[++i];
+      } else {
+        word += c;
+      }
+    } else if (c == ' ' || c == '\t') {
+      if (inWord) {
+        words.push_back(std::move(word));
+        word.clear();
+        inWord = false;
+      }
+    } else {
+      inWord = true;
+      if (c == '"' || c == '\'') {
+        quote = c;
+      } else if (c == '\\' && i + 1 < line.size()) {
+        word += line[++i];
+      } else {
+        word += c;
+      }
+    }
+  }
+
+  if (inWord) {
+    words.push_back(std::move(word));
+  }
+  return quote == 0;
+}
@@ -0,0 +1,93 @@
+#include "search.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#define SCORE_MATCH 16
+#define SCORE_BOUNDARY 8
+#define SCORE_CONSECUTIVE 6
+#define SCORE_EXACT 32
+#define PENALTY_GAP_START 3
+#define PENALTY_GAP_EXTEND 1
+#define PENALTY_MAX_LEADING 15
+
+static char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+static bool isWordChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || static_cast<unsigned char>(c) >= 0x80;
+}
+
+// True if name[i] starts a word: the first character, one after a separator
+// or an upper-case letter following a lower-case one.
+static bool isBoundary(std::string_view name, size_t i) {
+  if (i == 0) {
+    return true;
+  }
+  char prev = name[i - 1];
+  char c = name[i];
+  if (!isWordChar(prev)) {
+    return isWordChar(c);
+  }
+  return prev >= 'a' && prev <= 'z' && c >= 'A' && c <= 'Z';
+}
+
+int fuzzyScore(std::string_view query, std::string_view name) {
+  if (query.empty()) {
+    return 0;
+  }
+
+  // Cheap rejection first: most names do not contain the query at all.
+  size_t q = 0;
+  for (size_t i = 0; i < name.size() && q < query.size(); ++i) {
+    if (lower(name[i]) == lower(query[q])) {
+      ++q;
+    }
+  }
+  if (q < query.size()) {
+    return -1;
+  }
+
+  // Best alignment by dynamic programming over (query char, name position).
+  // row[j] is the best score with the current query character matched at
+  // name[j]; gap tracks the best previous row entry that a gap can follow.
+  const int none = std::numeric_limits<int>::min() / 2;
+  std::vector<int> prev(name.size(), none);
+  std::vector<int> row(name.size(), none);
+  for (q = 0; q < query.size(); ++q) {
+    int gap = none;
+    for (size_t j = 0; j < name.size(); ++j) {
+      if (q > 0 && j >= 2) {
+        gap = std::max(gap - PENALTY_GAP_EXTEND,
+                       prev[j - 2] - PENALTY_GAP_START);
+      }
+      row[j] = none;
+      if (lower(name[j]) != lower(query[q])) {
+        continue;
+      }
+
+      int before;
+      if (q == 0) {
+        before = -std::min<int>(j, PENALTY_MAX_LEADING);
+      } else {
+        before = gap;
+        if (j >= 1 && prev[j - 1] > none) {
+          before = std::max(before, prev[j - 1] + SCORE_CONSECUTIVE);
+        }
+      }
+      if (before <= none) {
+        continue;
+      }
+      row[j] = before + SCORE_MATCH +
+               (isBoundary(name, j) ? SCORE_BOUNDARY : 0);
+    }
+    std::swap(prev, row);
+  }
+
+  int score = *std::max_element(prev.begin(), prev.end());
+  if (query.size() == name.size()) {
+    score += SCORE_EXACT;
+  }
+  return score;
+}
@@ -0,0 +1,139 @@
+#include "secure.h"
+
+#include <algorithm>
+#include <new>
+#include <sodium.h>
+
+// Chunks are this large unless a single allocation needs more. sodium_malloc
+// surrounds each one with guard pages, so they are not made smaller.
+#define SECURE_CHUNK_SIZE (64 * 1024)
+#define SECURE_ALIGN 16
+
+static size_t alignUp(size_t n) {
+  return (n + SECURE_ALIGN - 1) & ~size_t(SECURE_ALIGN - 1);
+}
+
+SecureArena &SecureArena::Instance() {
+  static SecureArena arena;
+  return arena;
+}
+
+SecureArena::~SecureArena() {
+  // sodium_free zeroes the chunk before unlocking and releasing it.
+  for (Chunk &chunk : chunks) {
+    sodium_free(chunk.data);
+  }
+}
+
+void *SecureArena::Allocate(size_t size) {
+  size = alignUp(size == 0 ? 1 : size);
+  std::lock_guard<std::mutex> guard(mutex);
+
+  auto reusable = freeBlocks.find(size);
+  if (reusable != freeBlocks.end() && !reusable->second.empty()) {
+    void *p = reusable->second.back();
+    reusable->second.pop_back();
+    return p;
+  }
+
+  // Chunks past current are empty after a Scope or Reset; reuse one that
+  // fits before asking for more memory.
+  while (current < chunks.size() &&
+         chunks[current].size - chunks[current].used < size) {
+    ++current;
+  }
+  if (current == chunks.size()) {
+    if (sodium_init() < 0) {
+      throw std::bad_alloc();
+    }
+    size_t chunkSize = std::max<size_t>(SECURE_CHUNK_SIZE, size);
+    void *data = sodium_malloc(chunkSize);
+    if (data == nullptr) {
+      throw std::bad_alloc();
+    }
+    chunks.push_back(Chunk{static_cast<char *>(data), chunkSize, 0});
+  }
+
+  Chunk &chunk = chunks[current];
+  void *p = chunk.data + chunk.used;
+  chunk.used += size;
+  return p;
+}
+
+void SecureArena::Deallocate(void *p, size_t size) {
+  if (p == nullptr) {
+    return;
+  }
+  size = alignUp(size == 0 ? 1 : size);
+  sodium_memzero(p, size);
+
+  // The most recent block is taken back at once, which makes growing a
+  // string in place cheap; anything else waits for an allocation of its
+  // size or for its scope to end.
+  std::lock_guard<std::mutex> guard(mutex);
+  if (current < chunks.size()) {
+    Chunk &chunk = chunks[current];
+    if (static_cast<char *>(p) + size == chunk.data + chunk.used) {
+      chunk.used -= size;
+      return;
+    }
+  }
+  freeBlocks[size].push_back(static_cast<char *>(p));
+}
+
+void SecureArena::Reset() {
+  std::lock_guard<std::mutex> guard(mutex);
+  release(0, 0);
+}
+
+size_t SecureArena::Used() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  size_t used = 0;
+  for (const Chunk &chunk : chunks) {
+    used += chunk.used;
+  }
+  return used;
+}
+
+// Zero and take back everything allocated after used bytes of chunk.
+void SecureArena::release(size_t chunk, size_t used) {
+  // Freed blocks in the memory taken back are gone with it.
+  auto released = [this, chunk, used](const char *p) {
+    for (size_t i = chunk; i < chunks.size(); ++i) {
+      const char *from = chunks[i].data + (i == chunk ? used : 0);
+      if (p >= from && p < chunks[i].data + chunks[i].size) {
+        return true;
+      }
+    }
+    return false;
+  };
+  for (auto &[size, blocks] : freeBlocks) {
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), released),
+                 blocks.end());
+  }
+
+  for (size_t i = chunk; i < chunks.size(); ++i) {
+    size_t from = i == chunk ? used : 0;
+    if (chunks[i].used > from) {
+      sodium_memzero(chunks[i].data + from, chunks[i].used - from);
+      chunks[i].used = from;
+    }
+  }
+  current = chunk;
+}
+
+SecureArena::Scope::Scope(SecureArena &arena) : arena(arena) {
+  std::lock_guard<std::mutex> guard(arena.mutex);
+  chunk = arena.current;
+  used = chunk < arena.chunks.size() ? arena.chunks[chunk].used : 0;
+}
+
+SecureArena::Scope::~Scope() {
+  std::lock_guard<std::mutex> guard(arena.mutex);
+  arena.release(chunk, used);
+}
+
+SecureString::~SecureString() {
+  resize(capacity()); // earlier, longer contents too
+  sodium_memzero(&(*this)[0], size());
+}
@@ -0,0 +1,786 @@
+#include "shard.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+
+#define VAULT_MAGIC "EPMV"
+#define VAULT_VERSION 3
+#define VAULT_VERSION_COMPRESSED 4
+#define BLOOM_BITS_PER_ENTRY 10
+#define BLOOM_HASHES 7
+#define LOG_MAGIC "EPML"
+#define LOG_VERSION 2
+#define LOG_HEADER_SIZE 8
+
+// The log is folded into the indexed file once it holds more than
+// COMPACT_MIN_RECORDS records and either exceeds COMPACT_MAX_RECORDS or
+// half the number of indexed entries. This keeps replay on open cheap while
+// small vaults are not rewritten on every change.
+#define COMPACT_MIN_RECORDS 64
+#define COMPACT_MAX_RECORDS 4096
+
+// FNV-1a followed by a 64-bit finalizer so that both halves are well mixed.
+static uint64_t hashName(const char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static uint32_t checksum(const char *data, size_t size) {
+  uint32_t hash = 0x811c9dc5;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x01000193;
+  }
+  return hash;
+}
+
+static uint64_t nextPowerOfTwo(uint64_t n) {
+  uint64_t p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+static size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+#define SLOT_OFFSET_BITS 40
+#define SLOT_OFFSET_MASK ((uint64_t(1) << SLOT_OFFSET_BITS) - 1)
+
+static IndexSlot makeSlot(uint64_t hash, uint64_t offset) {
+  return (hash >> SLOT_OFFSET_BITS << SLOT_OFFSET_BITS) | (offset + 1);
+}
+
+// Bit position of the i-th bloom probe (double hashing).
+static uint64_t bloomBit(uint64_t hash, uint32_t i, uint64_t bits) {
+  uint64_t h1 = hash & 0xffffffff;
+  uint64_t h2 = (hash >> 32) | 1;
+  return (h1 + i * h2) & (bits - 1);
+}
+
+void Shard::Open(const fs::path &path) {
+  stats::Timer timer(stats::PHASE_OPEN);
+  this->path = path;
+  logPath = path;
+  logPath.replace_extension(".log");
+
+  overlay.clear();
+  staged.clear();
+  openBase();
+  replayLog();
+
+  // Missing files record the error values, which compare equal later on.
+  std::error_code ec;
+  baseTime = fs::last_write_time(path, ec);
+  baseSize = fs::file_size(path, ec);
+  logFileSize = fs::file_size(logPath, ec);
+}
+
+bool Shard::Changed() const {
+  std::error_code ec;
+  if (fs::last_write_time(path, ec) != baseTime ||
+      fs::file_size(path, ec) != baseSize) {
+    return true;
+  }
+  return fs::file_size(logPath, ec) != logFileSize;
+}
+
+void Shard::openBase() {
+  header = nullptr;
+  version = VAULT_VERSION;
+  records = nullptr;
+  recordsEnd = nullptr;
+  names = nullptr;
+  blocks = nullptr;
+  rawSize = 0;
+  count = 0;
+  keyId = 0;
+  compression = Compression();
+  inflated.clear();
+
+  if (!file.Open(path) || file.Size() == 0) {
+    return;
+  }
+
+  const char *data = file.Data();
+  size_t size = file.Size();
+
+  // Headers before version 3 end at namesOffset.
+  if (size >= offsetof(VaultHeader, namesOffset) &&
+      memcmp(data, VAULT_MAGIC, 4) == 0) {
+    auto *hdr = reinterpret_cast<const VaultHeader *>(data);
+    if (hdr->version == 1) {
+      // Fixed-width records; the index is ignored and the records scanned.
+      if (hdr->recordsOffset + hdr->count * FIXED_ENTRY_SIZE > size) {
+        throw std::runtime_error("vault " + path.string() + " is corrupted");
+      }
+      version = 1;
+      records = data + hdr->recordsOffset;
+      count = hdr->count;
+      recordsEnd = records + count * FIXED_ENTRY_SIZE;
+      rawSize = recordsEnd - records;
+      return;
+    }
+
+    if (hdr->version < 2 || hdr->version > VAULT_VERSION_COMPRESSED) {
+      throw std::runtime_error("unsupported vault version " +
+                               std::to_string(hdr->version));
+    }
+
+    bool valid =
+        hdr->indexSlots > 0 && (hdr->indexSlots & (hdr->indexSlots - 1)) == 0 &&
+        hdr->indexSlots <= size / sizeof(IndexSlot) &&
+        hdr->bloomBits > 0 && (hdr->bloomBits & (hdr->bloomBits - 1)) == 0 &&
+        hdr->count < hdr->indexSlots &&
+        hdr->recordsOffset <= hdr->indexOffset &&
+        hdr->indexOffset - hdr->recordsOffset <= SLOT_OFFSET_MASK &&
+        hdr->indexOffset + hdr->indexSlots * sizeof(IndexSlot) <=
+            hdr->bloomOffset &&
+        hdr->bloomOffset + hdr->bloomBits / 8 <= size;
+    if (valid && hdr->version >= 3) {
+      valid = hdr->namesOffset % 8 == 0 &&
+              hdr->namesOffset >= hdr->bloomOffset + hdr->bloomBits / 8 &&
+              hdr->namesOffset <= size &&
+              hdr->count <= (size - hdr->namesOffset) / sizeof(uint64_t);
+    }
+    if (valid && hdr->version >= VAULT_VERSION_COMPRESSED) {
+      // Blocks themselves are checked as they are inflated.
+      valid = size >= sizeof(VaultHeader) && hdr->recordsOffset % 8 == 0 &&
+              hdr->rawSize <= SLOT_OFFSET_MASK && hdr->blockSize > 0 &&
+              hdr->blockCount < (hdr->indexOffset - hdr->recordsOffset) /
+                                    sizeof(BlockRef) &&
+              (hdr->blockCount > 0 || hdr->count == 0);
+    }
+    if (!valid) {
+      throw std::runtime_error("vault " + path.string() + " is corrupted");
+    }
+
+    header = hdr;
+    version = hdr->version;
+    count = hdr->count;
+    keyId = hdr->keyId;
+    if (version >= 3) {
+      names = reinterpret_cast<const uint64_t *>(data + hdr->namesOffset);
+    }
+    if (version >= VAULT_VERSION_COMPRESSED) {
+      blocks = reinterpret_cast<const BlockRef *>(data + hdr->recordsOffset);
+      rawSize = hdr->rawSize;
+      compression.level = hdr->level;
+      compression.blockSize = hdr->blockSize;
+      inflated.resize(hdr->blockCount);
+    } else {
+      records = data + hdr->recordsOffset;
+      recordsEnd = data + hdr->indexOffset;
+      rawSize = recordsEnd - records;
+    }
+    return;
+  }
+
+  // Headerless file from an older release: a bare array of entries.
+  if (size % FIXED_ENTRY_SIZE != 0) {
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+  version = 0;
+  records = data;
+  count = size / FIXED_ENTRY_SIZE;
+  recordsEnd = records + size;
+  rawSize = size;
+}
+
+void Shard::replayLog() {
+  logSize = 0;
+  logRecords = 0;
+  logVersion = LOG_VERSION;
+
+  MappedFile log;
+  if (!log.Open(logPath) || log.Size() < LOG_HEADER_SIZE) {
+    return;
+  }
+
+  const char *data = log.Data();
+  if (memcmp(data, LOG_MAGIC, 4) != 0) {
+    throw std::runtime_error("log " + logPath.string() + " is corrupted");
+  }
+
+  memcpy(&logVersion, data + 4, sizeof(logVersion));
+  if (logVersion != 1 && logVersion != LOG_VERSION) {
+    throw std::runtime_error("unsupported log version " +
+                             std::to_string(logVersion));
+  }
+
+  // Decode into a scratch list first so that a frame is applied entirely or
+  // not at all.
+  std::vector<LogRecord> frameRecords;
+  size_t offset = LOG_HEADER_SIZE;
+  while (offset + sizeof(LogFrame) <= log.Size()) {
+    LogFrame frame;
+    memcpy(&frame, data + offset, sizeof(frame));
+
+    const char *payload = data + offset + sizeof(frame);
+    if (frame.size > log.Size() - offset - sizeof(frame) ||
+        checksum(payload, frame.size) != frame.checksum) {
+      break; // torn tail from an interrupted commit
+    }
+
+    frameRecords.clear();
+    const char *p = payload;
+    const char *end = payload + frame.size;
+    bool valid = true;
+    while (p < end) {
+      LogRecord record;
+      record.op = static_cast<uint8_t>(*p++);
+      if (logVersion == 1) {
+        if (end - p < FIXED_ENTRY_SIZE) {
+          valid = false;
+          break;
+        }
+        record.entry.DeserializeFixed(p);
+        p += FIXED_ENTRY_SIZE;
+      } else if (!record.entry.Deserialize(p, end)) {
+        valid = false;
+        break;
+      }
+      frameRecords.push_back(std::move(record));
+    }
+    if (!valid) {
+      break;
+    }
+
+    for (LogRecord &record : frameRecords) {
+      if (record.op == LOG_PUT) {
+        std::string name = record.entry.GetName();
+        overlay[name] = std::move(record.entry);
+      } else {
+        overlay[record.entry.GetName()] = std::nullopt;
+      }
+    }
+
+    logRecords += frameRecords.size();
+    stats::add(stats::ENTRIES_DECODED, frameRecords.size());
+    offset += sizeof(frame) + frame.size;
+  }
+  logSize = offset;
+}
+
+bool Shard::bloomContains(uint64_t hash) const {
+  auto *bloom = reinterpret_cast<const uint8_t *>(file.Data() +
+                                                  header->bloomOffset);
+  for (uint32_t i = 0; i < header->bloomHashes; ++i) {
+    uint64_t bit = bloomBit(hash, i, header->bloomBits);
+    if ((bloom[bit / 8] & (1 << (bit % 8))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Inflates a block of a compressed file on first use.
+const std::string &Shard::inflate(size_t block) const {
+  std::string &raw = inflated[block];
+  if (!raw.empty()) {
+    return raw;
+  }
+
+  const BlockRef &ref = blocks[block];
+  const BlockRef &next = blocks[block + 1];
+  uint64_t dataStart = header->recordsOffset +
+                       (header->blockCount + 1) * sizeof(BlockRef);
+  if (ref.rawOffset >= next.rawOffset || next.rawOffset > rawSize ||
+      ref.fileOffset < dataStart || ref.fileOffset > next.fileOffset ||
+      next.fileOffset > header->indexOffset) {
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+
+  raw.resize(next.rawOffset - ref.rawOffset);
+  uLongf rawLength = raw.size();
+  if (uncompress(reinterpret_cast<Bytef *>(&raw[0]), &rawLength,
+                 reinterpret_cast<const Bytef *>(file.Data() + ref.fileOffset),
+                 next.fileOffset - ref.fileOffset) != Z_OK ||
+      rawLength != raw.size()) {
+    raw.clear();
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+  return raw;
+}
+
+// Start of the record at offset, and the end of the records around it.
+// Records never span blocks, so end is also the end of its block.
+const char *Shard::recordAt(uint64_t offset, const char *&end) const {
+  if (blocks == nullptr) {
+    end = recordsEnd;
+    return records + offset;
+  }
+
+  // The last block ref only marks the end, so the search covers blockCount.
+  const BlockRef *last = blocks + header->blockCount;
+  const BlockRef *it =
+      std::upper_bound(blocks, last, offset,
+                       [](uint64_t offset, const BlockRef &ref) {
+                         return offset < ref.rawOffset;
+                       });
+  if (it == blocks) {
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+  size_t block = it - blocks - 1;
+  const std::string &raw = inflate(block);
+  end = raw.data() + raw.size();
+  return raw.data() + (offset - blocks[block].rawOffset);
+}
+
+// Name of the record at offset, read in place.
+std::string_view Shard::nameAt(uint64_t offset) const {
+  if (offset >= rawSize) {
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+  const char *end;
+  const char *p = recordAt(offset, end);
+  uint64_t nameSize;
+  uint64_t passwordSize;
+  if (p >= end || !getVarint(p, end, nameSize) ||
+      !getVarint(p, end, passwordSize) ||
+      nameSize > static_cast<uint64_t>(end - p)) {
+    throw std::runtime_error("vault " + path.string() + " is corrupted");
+  }
+  return std::string_view(p, nameSize);
+}
+
+bool Shard::scan(const std::function<bool(const EntryView &)> &fn) const {
+  EntryView entry;
+  if (blocks != nullptr) {
+    size_t decoded = 0;
+    for (size_t block = 0; block < header->blockCount; ++block) {
+      const std::string &raw = inflate(block);
+      const char *p = raw.data();
+      const char *end = p + raw.size();
+      while (p < end) {
+        if (decoded == count || !entry.Deserialize(p, end)) {
+          throw std::runtime_error("vault " + path.string() + " is corrupted");
+        }
+        ++decoded;
+        if (!fn(entry)) {
+          stats::add(stats::ENTRIES_DECODED, decoded);
+          return false;
+        }
+      }
+    }
+    stats::add(stats::ENTRIES_DECODED, decoded);
+    return true;
+  }
+
+  const char *p = records;
+  for (size_t i = 0; i < count; ++i) {
+    if (version < 2) {
+      entry.DeserializeFixed(p);
+      p += FIXED_ENTRY_SIZE;
+    } else if (!entry.Deserialize(p, recordsEnd)) {
+      throw std::runtime_error("vault " + path.string() + " is corrupted");
+    }
+    if (!fn(entry)) {
+      stats::add(stats::ENTRIES_DECODED, i + 1);
+      return false;
+    }
+  }
+  stats::add(stats::ENTRIES_DECODED, count);
+  return true;
+}
+
+bool Shard::lookup(const std::string &name, EntryView &entry) const {
+  if (count == 0) {
+    return false;
+  }
+
+  // Older files carry no usable index and are scanned until they are
+  // rewritten.
+  if (header == nullptr) {
+    bool found = false;
+    scan([&](const EntryView &candidate) {
+      if (candidate.GetName() == name) {
+        entry = candidate;
+        found = true;
+      }
+      return !found;
+    });
+    return found;
+  }
+
+  uint64_t hash = hashName(name.data(), name.size());
+  if (!bloomContains(hash)) {
+    return false;
+  }
+
+  auto *slots =
+      reinterpret_cast<const IndexSlot *>(file.Data() + header->indexOffset);
+  uint64_t mask = header->indexSlots - 1;
+  uint64_t tag = hash >> SLOT_OFFSET_BITS;
+  // A valid index always has an empty slot; one without would probe forever.
+  uint64_t i = hash & mask;
+  for (uint64_t probes = 0; probes < header->indexSlots;
+       ++probes, i = (i + 1) & mask) {
+    IndexSlot slot = slots[i];
+    uint64_t offset = slot & SLOT_OFFSET_MASK;
+    if (offset == 0 || offset > rawSize) {
+      return false;
+    }
+    if (slot >> SLOT_OFFSET_BITS != tag) {
+      continue;
+    }
+
+    // Compare the name in place before decoding the whole record.
+    if (nameAt(offset - 1) == name) {
+      const char *end;
+      const char *start = recordAt(offset - 1, end);
+      if (!entry.Deserialize(start, end)) {
+        throw std::runtime_error("vault " + path.string() + " is corrupted");
+      }
+      stats::add(stats::ENTRIES_DECODED);
+      return true;
+    }
+  }
+  throw std::runtime_error("vault " + path.string() + " is corrupted");
+}
+
+std::optional<EntryView> Shard::Find(const std::string &name) const {
+  auto it = overlay.find(name);
+  if (it != overlay.end()) {
+    if (!it->second) {
+      return std::nullopt;
+    }
+    return EntryView(*it->second);
+  }
+
+  EntryView entry;
+  if (lookup(name, entry)) {
+    return entry;
+  }
+  return std::nullopt;
+}
+
+void Shard::Put(const PasswordEntry &entry) {
+  staged.push_back(LogRecord{LOG_PUT, entry});
+  overlay[entry.GetName()] = entry;
+}
+
+bool Shard::Remove(const std::string &name) {
+  if (!Find(name)) {
+    return false;
+  }
+  staged.push_back(LogRecord{LOG_DELETE, PasswordEntry(name, "")});
+  overlay[name] = std::nullopt;
+  return true;
+}
+
+void Shard::ForEach(const std::function<void(const EntryView &)> &fn) const {
+  std::string key; // reused so that probing the overlay does not allocate
+  scan([&](const EntryView &entry) {
+    if (entry.GetName().empty()) {
+      return true;
+    }
+    if (!overlay.empty()) {
+      key.assign(entry.GetName());
+      if (overlay.count(key) != 0) {
+        return true;
+      }
+    }
+    fn(entry);
+    return true;
+  });
+
+  for (auto &[_, entry] : overlay) {
+    if (entry) {
+      fn(EntryView(*entry));
+    }
+  }
+}
+
+void Shard::ForEachIndexed(
+    const std::function<void(const EntryView &)> &fn) const {
+  scan([&fn](const EntryView &entry) {
+    if (!entry.GetName().empty()) {
+      fn(entry);
+    }
+    return true;
+  });
+}
+
+void Shard::ForEachLogged(
+    const std::function<void(const std::string &, const PasswordEntry *)> &fn)
+    const {
+  for (auto &[name, entry] : overlay) {
+    fn(name, entry ? &*entry : nullptr);
+  }
+}
+
+void Shard::ForEachName(
+    std::string_view prefix,
+    const std::function<void(std::string_view)> &fn) const {
+  auto matches = [&prefix](std::string_view name) {
+    return !name.empty() && name.substr(0, prefix.size()) == prefix;
+  };
+
+  // Names from the log are few; sort them and merge them into the base order.
+  std::vector<std::string_view> logged;
+  for (auto &[name, entry] : overlay) {
+    if (entry && matches(name)) {
+      logged.push_back(name);
+    }
+  }
+  std::sort(logged.begin(), logged.end());
+
+  auto next = logged.begin();
+  std::string key;
+  auto emit = [&](std::string_view name) {
+    while (next != logged.end() && *next < name) {
+      fn(*next++);
+    }
+    if (!overlay.empty()) {
+      key.assign(name);
+      if (overlay.count(key) != 0) {
+        return;
+      }
+    }
+    fn(name);
+  };
+
+  if (names != nullptr) {
+    const uint64_t *begin =
+        std::lower_bound(names, names + count, prefix,
+                         [this](uint64_t offset, std::string_view key) {
+                           return nameAt(offset) < key;
+                         });
+    for (const uint64_t *it = begin; it != names + count; ++it) {
+      std::string_view name = nameAt(*it);
+      if (!matches(name)) {
+        break;
+      }
+      emit(name);
+    }
+  } else {
+    // No name order in older files; collect and sort the matches instead.
+    std::vector<std::string_view> found;
+    scan([&](const EntryView &entry) {
+      if (matches(entry.GetName())) {
+        found.push_back(entry.GetName());
+      }
+      return true;
+    });
+    std::sort(found.begin(), found.end());
+    for (std::string_view name : found) {
+      emit(name);
+    }
+  }
+
+  while (next != logged.end()) {
+    fn(*next++);
+  }
+}
+
+std::vector<LogRecord> Shard::TakeStaged() {
+  std::vector<LogRecord> taken;
+  taken.swap(staged);
+  return taken;
+}
+
+bool Shard::needsCompaction(size_t records) const {
+  return records > COMPACT_MIN_RECORDS &&
+         (records > COMPACT_MAX_RECORDS || records * 2 > count);
+}
+
+void Shard::Commit() {
+  if (staged.empty()) {
+    return;
+  }
+
+  // A batch that would push the log over the threshold goes straight into a
+  // rewrite instead of being appended and compacted right after. Files in an
+  // older format are converted on their first write.
+  if (needsCompaction(logRecords + staged.size()) ||
+      (version < VAULT_VERSION && count > 0) ||
+      (logVersion != LOG_VERSION && logSize > 0)) {
+    Compact();
+    return;
+  }
+
+  std::string payload;
+  for (const LogRecord &record : staged) {
+    payload += static_cast<char>(record.op);
+    record.entry.Serialize(payload);
+  }
+
+  std::string data;
+  if (logSize < LOG_HEADER_SIZE) {
+    uint32_t version = LOG_VERSION;
+    data.append(LOG_MAGIC, 4);
+    data.append(reinterpret_cast<const char *>(&version), sizeof(version));
+  }
+
+  LogFrame frame;
+  frame.size = payload.size();
+  frame.checksum = checksum(payload.data(), payload.size());
+  data.append(reinterpret_cast<const char *>(&frame), sizeof(frame));
+  data.append(payload);
+
+  uint64_t offset = logSize < LOG_HEADER_SIZE ? 0 : logSize;
+  writeFileAt(logPath, offset, data);
+  logSize = offset + data.size();
+  logFileSize = logSize;
+  logRecords += staged.size();
+  staged.clear();
+}
+
+ShardBuilder::ShardBuilder(const Compression &compression)
+    : compression(compression), data(align8(sizeof(VaultHeader)), '\0') {}
+
+void ShardBuilder::Add(const EntryView &entry) {
+  if (entry.GetName().empty() || entry.GetPassword().empty()) {
+    return;
+  }
+  const size_t recordsOffset = align8(sizeof(VaultHeader));
+  std::string_view name = entry.GetName();
+  placed.emplace_back(hashName(name.data(), name.size()),
+                      data.size() - recordsOffset);
+  entry.Serialize(data);
+}
+
+// Replaces the records in data by a block table and the compressed blocks,
+// filling in the version 4 fields of hdr. Blocks end on record boundaries.
+std::string ShardBuilder::compressRecords(VaultHeader &hdr) const {
+  const size_t recordsOffset = align8(sizeof(VaultHeader));
+  const char *raw = data.data() + recordsOffset;
+  uint64_t rawSize = data.size() - recordsOffset;
+
+  std::vector<BlockRef> refs;
+  for (size_t i = 0; i < placed.size(); ++i) {
+    uint64_t offset = placed[i].second;
+    if (refs.empty() ||
+        offset - refs.back().rawOffset >= compression.blockSize) {
+      refs.push_back(BlockRef{offset, 0});
+    }
+  }
+
+  std::string file(recordsOffset + (refs.size() + 1) * sizeof(BlockRef), '\0');
+  std::string block;
+  for (size_t i = 0; i < refs.size(); ++i) {
+    uint64_t begin = refs[i].rawOffset;
+    uint64_t end = i + 1 < refs.size() ? refs[i + 1].rawOffset : rawSize;
+    uLongf size = compressBound(end - begin);
+    block.resize(size);
+    if (compress2(reinterpret_cast<Bytef *>(&block[0]), &size,
+                  reinterpret_cast<const Bytef *>(raw + begin), end - begin,
+                  compression.level) != Z_OK) {
+      throw std::runtime_error("unable to compress vault");
+    }
+    refs[i].fileOffset = file.size();
+    file.append(block.data(), size);
+  }
+  refs.push_back(BlockRef{rawSize, file.size()});
+  memcpy(&file[recordsOffset], refs.data(), refs.size() * sizeof(BlockRef));
+
+  hdr.version = VAULT_VERSION_COMPRESSED;
+  hdr.rawSize = rawSize;
+  hdr.blockCount = refs.size() - 1;
+  hdr.blockSize = compression.blockSize;
+  hdr.level = compression.level;
+  return file;
+}
+
+std::string ShardBuilder::Finish(uint32_t keyId) {
+  // Records are serialized straight after the header as they are added;
+  // the index, bloom filter and name order follow them.
+  const size_t recordsOffset = align8(sizeof(VaultHeader));
+  if (data.size() - recordsOffset > SLOT_OFFSET_MASK) {
+    throw std::runtime_error("vault is too large to index");
+  }
+
+  VaultHeader hdr{};
+  memcpy(hdr.magic, VAULT_MAGIC, 4);
+  hdr.version = VAULT_VERSION;
+  hdr.count = placed.size();
+  hdr.indexSlots = nextPowerOfTwo(placed.size() * 2 + 1);
+  hdr.bloomBits = nextPowerOfTwo(
+      std::max<uint64_t>(64, placed.size() * BLOOM_BITS_PER_ENTRY));
+  hdr.bloomHashes = BLOOM_HASHES;
+  hdr.keyId = keyId;
+  hdr.recordsOffset = recordsOffset;
+
+  // Order the records by name while data only holds the records, so that
+  // names can be compared in place.
+  std::vector<uint64_t> order(placed.size());
+  for (size_t i = 0; i < placed.size(); ++i) {
+    order[i] = placed[i].second;
+  }
+  auto recordName = [this, recordsOffset](uint64_t offset) {
+    const char *p = data.data() + recordsOffset + offset;
+    const char *end = data.data() + data.size();
+    uint64_t nameSize;
+    uint64_t passwordSize;
+    getVarint(p, end, nameSize);
+    getVarint(p, end, passwordSize);
+    return std::string_view(p, nameSize);
+  };
+  std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+    return recordName(a) < recordName(b);
+  });
+
+  std::string file;
+  if (compression.level > 0) {
+    file = compressRecords(hdr);
+  } else {
+    file.swap(data);
+  }
+
+  hdr.indexOffset = align8(file.size());
+  hdr.bloomOffset = hdr.indexOffset + hdr.indexSlots * sizeof(IndexSlot);
+  hdr.namesOffset = align8(hdr.bloomOffset + hdr.bloomBits / 8);
+
+  file.resize(hdr.namesOffset + order.size() * sizeof(uint64_t), '\0');
+  memcpy(&file[0], &hdr, sizeof(hdr));
+  memcpy(&file[hdr.namesOffset], order.data(), order.size() * sizeof(uint64_t));
+
+  auto *slots = reinterpret_cast<IndexSlot *>(&file[hdr.indexOffset]);
+  auto *bloom = reinterpret_cast<uint8_t *>(&file[hdr.bloomOffset]);
+  uint64_t mask = hdr.indexSlots - 1;
+
+  for (auto &[hash, offset] : placed) {
+    uint64_t i = hash & mask;
+    while (slots[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = makeSlot(hash, offset);
+
+    for (uint32_t k = 0; k < hdr.bloomHashes; ++k) {
+      uint64_t bit = bloomBit(hash, k, hdr.bloomBits);
+      bloom[bit / 8] |= 1 << (bit % 8);
+    }
+  }
+
+  // Start again with an empty builder.
+  data.assign(recordsOffset, '\0');
+  placed.clear();
+  return file;
+}
+
+void Shard::Compact() {
+  ShardBuilder builder(compression);
+  ForEach([&builder](const EntryView &entry) { builder.Add(entry); });
+
+  // The new file already holds everything in the log. If we crash before the
+  // log is removed, replaying it again on open is harmless.
+  writeFileAtomic(path, builder.Finish(keyId));
+  std::error_code ec;
+  fs::remove(logPath, ec);
+  Open(path);
+}
@@ -0,0 +1,100 @@
+#include "stats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace stats {
+
+bool enabled = false;
+
+static Format format = Format::Text;
+static std::chrono::steady_clock::time_point started;
+
+static std::atomic<uint64_t> counters[COUNTER_COUNT];
+static std::atomic<uint64_t> phaseNs[PHASE_COUNT];
+static std::atomic<uint64_t> phaseCalls[PHASE_COUNT];
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "prompt",  "read_key", "crypto_init", "kdf",    "open",
+    "decrypt", "encrypt",  "commit",      "compact"};
+
+static const char *counterNames[COUNTER_COUNT] = {
+    "bytes_read", "bytes_written", "entries_decoded", "cipher_calls",
+    "allocations"};
+
+void record(Counter counter, uint64_t n) {
+  counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void record(Phase phase, uint64_t ns) {
+  phaseNs[phase].fetch_add(ns, std::memory_order_relaxed);
+  phaseCalls[phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Written with stdio so that reporting neither allocates nor depends on the
+// state of std::cerr during exit.
+static void report() {
+  double wallMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - started)
+                      .count();
+
+  if (format == Format::Json) {
+    fprintf(stderr, "{\"wall_ms\": %.3f, \"phases\": {", wallMs);
+    bool first = true;
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+      uint64_t calls = phaseCalls[i].load();
+      if (calls == 0) {
+        continue;
+      }
+      fprintf(stderr, "%s\"%s\": {\"calls\": %llu, \"ms\": %.3f}",
+              first ? "" : ", ", phaseNames[i],
+              static_cast<unsigned long long>(calls), phaseNs[i].load() / 1e6);
+      first = false;
+    }
+    fprintf(stderr, "}, \"counters\": {");
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+      fprintf(stderr, "%s\"%s\": %llu", i ? ", " : "", counterNames[i],
+              static_cast<unsigned long long>(counters[i].load()));
+    }
+    fprintf(stderr, "}}\n");
+    return;
+  }
+
+  fprintf(stderr, "epm stats: %.3f ms wall\n", wallMs);
+  for (int i = 0; i < PHASE_COUNT; ++i) {
+    uint64_t calls = phaseCalls[i].load();
+    if (calls != 0) {
+      fprintf(stderr, "  %-16s %10.3f ms %8llu calls\n", phaseNames[i],
+              phaseNs[i].load() / 1e6, static_cast<unsigned long long>(calls));
+    }
+  }
+  for (int i = 0; i < COUNTER_COUNT; ++i) {
+    fprintf(stderr, "  %-16s %10llu\n", counterNames[i],
+            static_cast<unsigned long long>(counters[i].load()));
+  }
+}
+
+void enable(Format format) {
+  stats::format = format;
+  if (!enabled) {
+    enabled = true;
+    started = std::chrono::steady_clock::now();
+    atexit(report);
+  }
+}
+
+void enableFromEnvironment() {
+  const char *trace = std::getenv("EPM_TRACE");
+  if (trace == nullptr) {
+    return;
+  }
+  if (strcmp(trace, "json") == 0) {
+    enable(Format::Json);
+  } else if (strcmp(trace, "1") == 0 || strcmp(trace, "text") == 0) {
+    enable(Format::Text);
+  }
+}
+
+} // namespace stats
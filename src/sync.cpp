@@ -0,0 +1,298 @@
+#include "sync.h"
+#include "codec.h"
+
+#include <cstring>
+#include <fstream>
+#include <sodium.h>
+#include <stdexcept>
+#include <vector>
+
+#define SYNC_STATE_MAGIC "EPMY"
+#define SYNC_STATE_VERSION 2 // version 1 has no commit counters
+
+// A state file is the header, a byte per bucket that is 1 if the vaults
+// agreed on it after a sync, the bucket digests they agreed on, and the
+// commit counters of the local and the other vault after that sync.
+struct SyncStateHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t buckets;
+  uint32_t reserved;
+};
+
+struct SyncState {
+  std::vector<uint8_t> known;
+  std::vector<Digest> digests;
+  uint64_t commits[2] = {0, 0};
+};
+
+SyncChoice lastWriterWins(const SyncConflict &conflict) {
+  if (conflict.localTime != conflict.otherTime) {
+    return conflict.localTime > conflict.otherTime ? SyncChoice::Local
+                                                   : SyncChoice::Other;
+  }
+  return conflict.localDigest > conflict.otherDigest ? SyncChoice::Local
+                                                     : SyncChoice::Other;
+}
+
+fs::path syncStatePath(const fs::path &local, const fs::path &other) {
+  std::string otherPath = fs::weakly_canonical(other).string();
+  unsigned char hash[crypto_generichash_BYTES_MIN];
+  crypto_generichash(hash, sizeof(hash),
+                     reinterpret_cast<const unsigned char *>(otherPath.data()),
+                     otherPath.size(), NULL, 0);
+  char hex[17];
+  codec::hexEncode(hash, 8, hex);
+  hex[16] = '\0';
+  return local.parent_path() /
+         (local.stem().string() + "-sync-" + hex + ".state");
+}
+
+// A missing or damaged state file is the same as none: no bucket is known.
+// Version 1 files leave the commit counters at 0.
+static SyncState readState(const fs::path &path) {
+  SyncState state{std::vector<uint8_t>(DIGEST_BUCKETS, 0),
+                  std::vector<Digest>(DIGEST_BUCKETS, Digest{})};
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  SyncStateHeader hdr;
+  SyncState read = state;
+  if (file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) &&
+      memcmp(hdr.magic, SYNC_STATE_MAGIC, 4) == 0 &&
+      (hdr.version == 1 || hdr.version == SYNC_STATE_VERSION) &&
+      hdr.buckets == DIGEST_BUCKETS &&
+      file.read(reinterpret_cast<char *>(read.known.data()),
+                read.known.size()) &&
+      file.read(reinterpret_cast<char *>(read.digests.data()),
+                read.digests.size() * sizeof(Digest)) &&
+      (hdr.version == 1 ||
+       file.read(reinterpret_cast<char *>(read.commits),
+                 sizeof(read.commits)))) {
+    return read;
+  }
+  return state;
+}
+
+static void writeState(const fs::path &path, const SyncState &state) {
+  SyncStateHeader hdr{};
+  memcpy(hdr.magic, SYNC_STATE_MAGIC, 4);
+  hdr.version = SYNC_STATE_VERSION;
+  hdr.buckets = DIGEST_BUCKETS;
+
+  std::string data(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  data.append(reinterpret_cast<const char *>(state.known.data()),
+              state.known.size());
+  data.append(reinterpret_cast<const char *>(state.digests.data()),
+              state.digests.size() * sizeof(Digest));
+  data.append(reinterpret_cast<const char *>(state.commits),
+              sizeof(state.commits));
+  writeFileAtomic(path, data);
+}
+
+// Sync with both vaults locked.
+static SyncReport reconcile(Vault &local, Vault &other, PasswordManager &pm,
+                            const fs::path &statePath,
+                            const ConflictResolver &resolve) {
+  // A vault that records its key is refused outright if it is another one;
+  // otherwise every entry copied has to open with pm.
+  uint32_t keyId = pm.Fingerprint();
+  for (const Vault *vault : {&local, &other}) {
+    if (vault->KeyId() != 0 && vault->KeyId() != keyId) {
+      throw std::runtime_error(vault->Path().string() +
+                               " is encrypted with another key");
+    }
+  }
+
+  VaultDigests localDigests;
+  VaultDigests otherDigests;
+  localDigests.Load(local);
+  otherDigests.Load(other);
+  SyncState state = readState(statePath);
+  SyncReport report;
+  // An empty vault created again in place of one synced before, which its
+  // commit counter tells by going back, is filled as on a first sync instead
+  // of emptying the other. A vault whose entries were all deleted since the
+  // last sync has its deletions carried over like any other.
+  bool fresh = (localDigests.Size() == 0 &&
+                local.Commits() < state.commits[0]) ||
+               (otherDigests.Size() == 0 && other.Commits() < state.commits[1]);
+
+  auto find = [](const Vault &vault, std::string_view name) {
+    std::optional<EntryView> entry = vault.Find(std::string(name));
+    if (!entry) {
+      throw std::runtime_error("vault " + vault.Path().string() +
+                               " changed during sync");
+    }
+    return PasswordEntry(*entry);
+  };
+  // Only a sealed entry authenticates, so a legacy one is trusted in the
+  // local vault alone.
+  auto open = [&pm, &local](const Vault &vault, const PasswordEntry &entry) {
+    try {
+      return &vault == &local ? pm.decrypt(entry.GetPassword())
+                              : pm.decryptSealed(entry.GetPassword());
+    } catch (const std::runtime_error &) {
+      throw std::runtime_error("entry '" + entry.GetName() + "' in " +
+                               vault.Path().string() +
+                               " does not open with this key");
+    }
+  };
+  // Copy name from one vault to the other, making sure it opens first.
+  auto copy = [&](const Vault &from, Vault &to, std::string_view name) {
+    PasswordEntry entry = find(from, name);
+    open(from, entry);
+    to.Put(entry);
+  };
+
+  for (size_t b = 0; b < DIGEST_BUCKETS; ++b) {
+    if (localDigests.Bucket(b) == otherDigests.Bucket(b)) {
+      continue;
+    }
+    ++report.bucketsDiffering;
+    // A bucket one side left as it was at the last sync is taken from the
+    // other side as it is, deletions included.
+    bool localChanged = fresh || !state.known[b] ||
+                        localDigests.Bucket(b) != state.digests[b];
+    bool otherChanged = fresh || !state.known[b] ||
+                        otherDigests.Bucket(b) != state.digests[b];
+
+    std::vector<DigestedEntry> here = localDigests.Entries(b);
+    std::vector<DigestedEntry> there = otherDigests.Entries(b);
+    report.entriesCompared += here.size() + there.size();
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < here.size() || j < there.size()) {
+      if (j == there.size() ||
+          (i < here.size() && here[i].name < there[j].name)) {
+        const DigestedEntry &entry = here[i++];
+        if (localChanged) {
+          copy(local, other, entry.name);
+          otherDigests.Update(entry.name, std::nullopt, entry.digest);
+          ++report.copiedToOther;
+        } else {
+          local.Remove(std::string(entry.name));
+          localDigests.Update(entry.name, entry.digest, std::nullopt);
+          ++report.removedFromLocal;
+        }
+        continue;
+      }
+      if (i == here.size() || there[j].name < here[i].name) {
+        const DigestedEntry &entry = there[j++];
+        if (otherChanged) {
+          copy(other, local, entry.name);
+          localDigests.Update(entry.name, std::nullopt, entry.digest);
+          ++report.copiedToLocal;
+        } else {
+          other.Remove(std::string(entry.name));
+          otherDigests.Update(entry.name, entry.digest, std::nullopt);
+          ++report.removedFromOther;
+        }
+        continue;
+      }
+
+      const DigestedEntry &ours = here[i++];
+      const DigestedEntry &theirs = there[j++];
+      if (ours.digest == theirs.digest) {
+        continue;
+      }
+
+      SyncChoice choice;
+      if (!localChanged) {
+        choice = SyncChoice::Other;
+      } else if (!otherChanged) {
+        choice = SyncChoice::Local;
+      } else {
+        PasswordEntry localEntry = find(local, ours.name);
+        PasswordEntry otherEntry = find(other, theirs.name);
+        SyncConflict conflict{
+            ours.name, PasswordManager::SealedTime(localEntry.GetPassword()),
+            PasswordManager::SealedTime(otherEntry.GetPassword()), ours.digest,
+            theirs.digest};
+        // The same password sealed twice differs only in its nonce; keep
+        // either, the same one whichever side runs the sync.
+        if (open(local, localEntry) == open(other, otherEntry)) {
+          choice = ours.digest > theirs.digest ? SyncChoice::Local
+                                               : SyncChoice::Other;
+        } else {
+          choice = resolve(conflict);
+          ++report.conflicts;
+        }
+      }
+
+      if (choice == SyncChoice::Local) {
+        copy(local, other, ours.name);
+        otherDigests.Update(ours.name, theirs.digest, ours.digest);
+        ++report.copiedToOther;
+      } else if (choice == SyncChoice::Other) {
+        copy(other, local, theirs.name);
+        localDigests.Update(ours.name, ours.digest, theirs.digest);
+        ++report.copiedToLocal;
+      } else {
+        ++report.skipped;
+      }
+    }
+  }
+
+  // Both vaults now hold entries under pm's key; record it, so that a later
+  // sync or rekey with another key is refused. Only a compaction writes it.
+  std::vector<Vault *> stamp;
+  for (Vault *vault : {&local, &other}) {
+    if (vault->KeyId() != keyId) {
+      vault->SetKeyId(keyId);
+      stamp.push_back(vault);
+    }
+  }
+
+  other.Commit();
+  local.Commit();
+  for (Vault *vault : stamp) {
+    vault->Compact();
+  }
+
+  // Buckets left apart keep what the vaults last agreed on, so that a
+  // skipped conflict comes up again.
+  for (size_t b = 0; b < DIGEST_BUCKETS; ++b) {
+    if (localDigests.Bucket(b) == otherDigests.Bucket(b)) {
+      state.known[b] = 1;
+      state.digests[b] = localDigests.Bucket(b);
+    }
+  }
+  state.commits[0] = local.Commits();
+  state.commits[1] = other.Commits();
+  writeState(statePath, state);
+  return report;
+}
+
+SyncReport syncVaults(Vault &local, Vault &other, PasswordManager &pm,
+                      const fs::path &statePath,
+                      const ConflictResolver &resolve) {
+  fs::path localPath = fs::weakly_canonical(local.Path());
+  fs::path otherPath = fs::weakly_canonical(other.Path());
+  if (localPath == otherPath) {
+    throw std::runtime_error("a vault cannot be synced with itself");
+  }
+
+  // Every sync locks a pair in the same order, so that two syncs of the same
+  // vaults never wait for each other.
+  Vault &first = localPath < otherPath ? local : other;
+  Vault &second = localPath < otherPath ? other : local;
+  first.LockExclusive();
+  try {
+    second.LockExclusive();
+  } catch (...) {
+    first.Unlock();
+    throw;
+  }
+
+  SyncReport report;
+  try {
+    report = reconcile(local, other, pm, statePath, resolve);
+  } catch (...) {
+    second.Unlock();
+    first.Unlock();
+    throw;
+  }
+  second.Unlock();
+  first.Unlock();
+  return report;
+}
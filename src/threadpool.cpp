@@ -0,0 +1,103 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // The calling thread takes part in every loop.
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain,
+                             const std::function<void(size_t, size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  if (grain == 0) {
+    grain = 1;
+  }
+
+  // Not worth waking anybody for a single range.
+  if (workers.empty() || count <= grain) {
+    fn(0, count);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &fn;
+    jobCount = count;
+    jobGrain = grain;
+    next = 0;
+    active = workers.size();
+    error = nullptr;
+    ++generation;
+  }
+  wake.notify_all();
+
+  runRanges();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return active == 0; });
+  job = nullptr;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void ThreadPool::runRanges() {
+  while (true) {
+    size_t begin = next.fetch_add(jobGrain);
+    if (begin >= jobCount) {
+      return;
+    }
+    try {
+      (*job)(begin, std::min(begin + jobGrain, jobCount));
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      // Skip the remaining ranges.
+      next = jobCount;
+    }
+  }
+}
+
+void ThreadPool::workerLoop() {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+
+    runRanges();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --active;
+    }
+    done.notify_one();
+  }
+}
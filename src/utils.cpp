@@ -1,6 +1,5 @@
 #include "utils.h"
-
-#define BASENAME "epm.bin"
+#include "stats.h"
 
 fs::path getPlatformPath() {
   fs::path path;
@@ -9,37 +8,30 @@ fs::path getPlatformPath() {
 #if defined(_WIN32) || defined(_WIN64)
   const char *appdata = std::getenv("APPDATA");
   if (appdata == nullptr) {
-    std::cout
-        << "Could not get APPDATA environment variable. Using current path"
-        << std::endl;
-    return fs::current_path();
+    return path;
   }
 
-  path = fs::path(appdata) / "epm" / BASENAME;
+  path = fs::path(appdata) / "epm" / VAULT_FILE;
 
 // Check for macOS
 #elif defined(__APPLE__)
   // Get the HOME environment variable
   const char *home = std::getenv("HOME");
   if (home == nullptr) {
-    std::cout << "Could not get HOME environment variable. Using current path"
-              << std::endl;
-    return fs::current_path();
+    return path;
   }
 
-  path = fs::path(home) / "Library" / "Application Support" / "epm" / BASENAME;
+  path = fs::path(home) / "Library" / "Application Support" / "epm" / VAULT_FILE;
 
 // Assume Linux or other POSIX-compliant systems
 #else
   // Get the HOME environment variable
   const char *home = std::getenv("HOME");
   if (home == nullptr) {
-    std::cout << "Could not get HOME environment variable. Using current path"
-              << std::endl;
-    return fs::current_path();
+    return path;
   }
 
-  path = fs::path(home) / ".config" / "epm" / BASENAME;
+  path = fs::path(home) / ".config" / "epm" / VAULT_FILE;
 #endif
 
   return path;
@@ -56,3 +48,306 @@ void makeDirs(const fs::path &path) {
     }
   }
 }
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <fstream>
+#include <sstream>
+
+void writeFileAtomic(const fs::path &path, std::string_view data) {
+  stats::add(stats::BYTES_WRITTEN, data.size());
+  fs::path tmp = path;
+  tmp += ".tmp";
+
+  std::ofstream file(tmp, std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("unable to open " + tmp.string());
+  }
+  file.write(data.data(), data.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("unable to write " + tmp.string());
+  }
+  fs::rename(tmp, path);
+}
+
+void createPrivateFile(const fs::path &path) {
+  std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("unable to create " + path.string());
+  }
+  file.close();
+  std::error_code code;
+  fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write, code);
+  if (code) {
+    throw std::runtime_error("unable to restrict " + path.string() + " : " +
+                             code.message());
+  }
+}
+
+void writeFileAt(const fs::path &path, uint64_t offset,
+                 const std::string &data) {
+  stats::add(stats::BYTES_WRITTEN, data.size());
+  if (fs::exists(path) && fs::file_size(path) != offset) {
+    fs::resize_file(path, offset);
+  }
+
+  std::ofstream file(path, std::ios::out | std::ios::app | std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("unable to open " + path.string());
+  }
+  file.write(data.data(), data.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("unable to write " + path.string());
+  }
+}
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const fs::path &path) {
+  Close();
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  buffer = contents.str();
+  data = buffer.data();
+  size = buffer.size();
+  stats::add(stats::BYTES_READ, size);
+  return true;
+}
+
+void MappedFile::Close() {
+  buffer.clear();
+  data = nullptr;
+  size = 0;
+}
+
+LockFile::~LockFile() {}
+bool LockFile::Open(const fs::path &) { return true; }
+void LockFile::Close() {}
+bool LockFile::IsOpen() const { return true; }
+bool LockFile::Lock(bool) { return true; }
+void LockFile::Unlock() {}
+uint64_t LockFile::ReadCounter() const { return 0; }
+void LockFile::WriteCounter(uint64_t) {}
+
+#else
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void writeFileAtomic(const fs::path &path, std::string_view data) {
+  stats::add(stats::BYTES_WRITTEN, data.size());
+  // A unique name in the same directory, so that concurrent writers never
+  // share a temporary file and the rename stays on one file system.
+  std::string tmp = path.string() + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    throw std::runtime_error("unable to create a temporary file for " +
+                             path.string() + " : " + strerror(errno));
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      close(fd);
+      unlink(tmp.c_str());
+      throw std::runtime_error("unable to write " + tmp + " : " +
+                               strerror(err));
+    }
+    written += n;
+  }
+
+  if (fsync(fd) != 0) {
+    int err = errno;
+    close(fd);
+    unlink(tmp.c_str());
+    throw std::runtime_error("unable to flush " + tmp + " : " + strerror(err));
+  }
+  if (close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+    int err = errno;
+    unlink(tmp.c_str());
+    throw std::runtime_error("unable to replace " + path.string() + " : " +
+                             strerror(err));
+  }
+
+  // The rename itself is only durable once the directory is flushed.
+  fs::path dir = path.parent_path();
+  if (dir.empty()) {
+    dir = ".";
+  }
+  int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd < 0 || fsync(dirFd) != 0) {
+    int err = errno;
+    if (dirFd >= 0) {
+      close(dirFd);
+    }
+    throw std::runtime_error("unable to flush " + dir.string() + " : " +
+                             strerror(err));
+  }
+  close(dirFd);
+}
+
+void createPrivateFile(const fs::path &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("unable to create " + path.string() + " : " +
+                             strerror(errno));
+  }
+  // An existing file keeps its mode; narrow it before anything is written.
+  if (fchmod(fd, S_IRUSR | S_IWUSR) != 0) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error("unable to restrict " + path.string() + " : " +
+                             strerror(err));
+  }
+  close(fd);
+}
+
+void writeFileAt(const fs::path &path, uint64_t offset,
+                 const std::string &data) {
+  stats::add(stats::BYTES_WRITTEN, data.size());
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("unable to open " + path.string() + " : " +
+                             strerror(errno));
+  }
+
+  // A torn write from an earlier crash may have left garbage past offset.
+  if (ftruncate(fd, offset) != 0) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error("unable to truncate " + path.string() + " : " +
+                             strerror(err));
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = pwrite(fd, data.data() + written, data.size() - written,
+                       offset + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      close(fd);
+      throw std::runtime_error("unable to write " + path.string() + " : " +
+                               strerror(err));
+    }
+    written += n;
+  }
+
+  if (fsync(fd) != 0 || close(fd) != 0) {
+    throw std::runtime_error("unable to flush " + path.string() + " : " +
+                             strerror(errno));
+  }
+}
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const fs::path &path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // mmap rejects zero-length mappings; an empty file is a valid empty view.
+  if (st.st_size > 0) {
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("unable to map " + path.string() + " : " +
+                               strerror(errno));
+    }
+    data = static_cast<const char *>(addr);
+    size = st.st_size;
+    stats::add(stats::BYTES_READ, size); // mapped, read as pages are touched
+  }
+  close(fd);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data != nullptr) {
+    munmap(const_cast<char *>(data), size);
+  }
+  data = nullptr;
+  size = 0;
+}
+
+LockFile::~LockFile() { Close(); }
+
+bool LockFile::Open(const fs::path &path) {
+  Close();
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    // A reader without write access can still share an existing lock.
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+  return fd >= 0;
+}
+
+void LockFile::Close() {
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = -1;
+}
+
+bool LockFile::IsOpen() const { return fd >= 0; }
+
+bool LockFile::Lock(bool exclusive) {
+  if (fd < 0) {
+    return false;
+  }
+  while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+    if (errno != EINTR) {
+      throw std::runtime_error(std::string("unable to lock vault : ") +
+                               strerror(errno));
+    }
+  }
+  return true;
+}
+
+void LockFile::Unlock() {
+  if (fd >= 0) {
+    flock(fd, LOCK_UN);
+  }
+}
+
+uint64_t LockFile::ReadCounter() const {
+  uint64_t counter = 0;
+  if (fd < 0 || pread(fd, &counter, sizeof(counter), 0) != sizeof(counter)) {
+    return 0;
+  }
+  return counter;
+}
+
+void LockFile::WriteCounter(uint64_t counter) {
+  if (fd < 0 || pwrite(fd, &counter, sizeof(counter), 0) != sizeof(counter)) {
+    throw std::runtime_error(std::string("unable to update vault lock : ") +
+                             strerror(errno));
+  }
+}
+#endif
@@ -0,0 +1,412 @@
+#include "vault.h"
+#include "stats.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+
+#define MANIFEST_MAGIC "EPMS"
+#define MANIFEST_VERSION 1
+#define MAX_SHARDS 4096
+
+// Shard of a name among count shards. Uses FNV-1a 32, which is unrelated to
+// the hash a shard indexes names by, so every shard's index stays uniform.
+static size_t shardOf(std::string_view name, size_t count) {
+  if (count <= 1) {
+    return 0;
+  }
+  uint32_t hash = 0x811c9dc5;
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 0x01000193;
+  }
+  return hash % count;
+}
+
+static fs::path logPathOf(const fs::path &path) {
+  fs::path log = path;
+  log.replace_extension(".log");
+  return log;
+}
+
+// Digests of a shard's entries, written by sync (see digest.h).
+static fs::path sumPathOf(const fs::path &path) {
+  fs::path sum = path;
+  sum.replace_extension(".sum");
+  return sum;
+}
+
+// Reads the manifest at path. Returns false if path holds no manifest.
+static bool readManifest(const fs::path &path, VaultManifest &manifest) {
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  return file.read(reinterpret_cast<char *>(&manifest), sizeof(manifest)) &&
+         memcmp(manifest.magic, MANIFEST_MAGIC, 4) == 0;
+}
+
+void Vault::Open(const fs::path &path) {
+  this->path = path;
+  lockDepth = 0;
+
+  // Reopening the lock file drops any lock held on the previous one.
+  fs::path lockPath = path;
+  lockPath.replace_extension(".lock");
+  lock.Open(lockPath);
+
+  bool locked = lock.Lock(false);
+  try {
+    load();
+  } catch (...) {
+    if (locked) {
+      lock.Unlock();
+    }
+    throw;
+  }
+  if (locked) {
+    lock.Unlock();
+  }
+}
+
+// Reads the manifest and opens a single-file vault. The caller holds the
+// lock.
+void Vault::load() {
+  sharded = false;
+  generation = 0;
+  shardCount = 1;
+  diskKeyId = 0;
+  newKeyId.reset();
+  shards.clear();
+
+  // Missing files record the error values, which compare equal later on.
+  std::error_code ec;
+  manifestTime = fs::last_write_time(path, ec);
+  manifestSize = fs::file_size(path, ec);
+  commits = lock.ReadCounter();
+
+  VaultManifest manifest;
+  if (readManifest(path, manifest)) {
+    if (manifest.version != MANIFEST_VERSION) {
+      throw std::runtime_error("unsupported vault manifest version " +
+                               std::to_string(manifest.version));
+    }
+    if (manifest.shardCount < 2 || manifest.shardCount > MAX_SHARDS) {
+      throw std::runtime_error("vault " + path.string() + " is corrupted");
+    }
+    sharded = true;
+    generation = manifest.generation;
+    shardCount = manifest.shardCount;
+    diskKeyId = manifest.keyId;
+  }
+
+  shards.resize(shardCount);
+  if (!sharded) {
+    // Opened right away, so that a damaged vault is reported here.
+    diskKeyId = shard(0).KeyId();
+  }
+}
+
+fs::path Vault::shardPath(uint64_t generation, size_t index) const {
+  return path.parent_path() /
+         (path.stem().string() + "-" + std::to_string(generation) + "-" +
+          std::to_string(index) + path.extension().string());
+}
+
+Shard &Vault::shard(size_t index) const {
+  if (shards[index]) {
+    return *shards[index];
+  }
+
+  auto opened = std::make_unique<Shard>();
+  if (!sharded) {
+    opened->Open(path);
+  } else {
+    // The manifest may be much older than this first use of the shard; make
+    // sure it still names the files about to be read.
+    bool locked = lockDepth == 0 && lock.Lock(false);
+    try {
+      VaultManifest manifest;
+      if (!readManifest(path, manifest) || manifest.generation != generation) {
+        throw std::runtime_error("vault " + path.string() +
+                                 " was rewritten by another process");
+      }
+      opened->Open(shardPath(generation, index));
+    } catch (...) {
+      if (locked) {
+        lock.Unlock();
+      }
+      throw;
+    }
+    if (locked) {
+      lock.Unlock();
+    }
+  }
+  shards[index] = std::move(opened);
+  return *shards[index];
+}
+
+void Vault::removeShards(uint64_t generation, size_t count) const {
+  std::error_code ec;
+  for (size_t i = 0; i < count; ++i) {
+    fs::path file = shardPath(generation, i);
+    fs::remove(file, ec);
+    fs::remove(logPathOf(file), ec);
+    fs::remove(sumPathOf(file), ec);
+  }
+}
+
+std::optional<EntryView> Vault::Find(const std::string &name) const {
+  return shard(shardOf(name, shardCount)).Find(name);
+}
+
+void Vault::Put(const PasswordEntry &entry) {
+  shard(shardOf(entry.GetName(), shardCount)).Put(entry);
+}
+
+bool Vault::Remove(const std::string &name) {
+  return shard(shardOf(name, shardCount)).Remove(name);
+}
+
+void Vault::ForEach(const std::function<void(const EntryView &)> &fn) const {
+  for (size_t i = 0; i < shardCount; ++i) {
+    shard(i).ForEach(fn);
+  }
+}
+
+void Vault::ForEachName(
+    std::string_view prefix,
+    const std::function<void(std::string_view)> &fn) const {
+  if (shardCount == 1) {
+    shard(0).ForEachName(prefix, fn);
+    return;
+  }
+
+  // Every shard yields its names in order; merge them. A name lives in
+  // exactly one shard, so there are no duplicates to drop.
+  std::vector<std::vector<std::string_view>> lists(shardCount);
+  for (size_t i = 0; i < shardCount; ++i) {
+    shard(i).ForEachName(prefix, [&lists, i](std::string_view name) {
+      lists[i].push_back(name);
+    });
+  }
+
+  typedef std::pair<std::string_view, size_t> Head; // name, list
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  std::vector<size_t> next(shardCount, 0);
+  for (size_t i = 0; i < shardCount; ++i) {
+    if (!lists[i].empty()) {
+      heads.emplace(lists[i][0], i);
+    }
+  }
+  while (!heads.empty()) {
+    auto [name, i] = heads.top();
+    heads.pop();
+    fn(name);
+    if (++next[i] < lists[i].size()) {
+      heads.emplace(lists[i][next[i]], i);
+    }
+  }
+}
+
+void Vault::LockExclusive() {
+  if (lockDepth > 0) {
+    ++lockDepth;
+    return;
+  }
+  if (!lock.Lock(true)) {
+    throw std::runtime_error("unable to lock vault " + path.string());
+  }
+  lockDepth = 1;
+
+  try {
+    if (lock.ReadCounter() != commits || Changed()) {
+      reload();
+    }
+  } catch (...) {
+    Unlock();
+    throw;
+  }
+}
+
+void Vault::Unlock() {
+  if (lockDepth > 0 && --lockDepth == 0) {
+    lock.Unlock();
+  }
+}
+
+// Another process changed the vault since it was loaded. Load it again and
+// stage the changes made here on top of what is there now.
+void Vault::reload() {
+  std::vector<LogRecord> pending;
+  for (auto &opened : shards) {
+    if (opened) {
+      std::vector<LogRecord> staged = opened->TakeStaged();
+      std::move(staged.begin(), staged.end(), std::back_inserter(pending));
+    }
+  }
+
+  uint32_t loadedKeyId = diskKeyId;
+  std::optional<uint32_t> keyId = newKeyId;
+  load();
+  newKeyId = keyId;
+
+  // Entries encrypted with the old key must not land in a re-encrypted vault.
+  if (!pending.empty() && diskKeyId != loadedKeyId) {
+    throw std::runtime_error("the vault was re-encrypted by another process");
+  }
+
+  for (LogRecord &record : pending) {
+    if (record.op == LOG_PUT) {
+      Put(record.entry);
+    } else {
+      Remove(record.entry.GetName());
+    }
+  }
+}
+
+// Tell other processes that the vault changed, and remember what it looks
+// like now so that this process does not reload its own changes.
+void Vault::bumpCommits() {
+  commits = lock.ReadCounter() + 1;
+  lock.WriteCounter(commits);
+
+  std::error_code ec;
+  manifestTime = fs::last_write_time(path, ec);
+  manifestSize = fs::file_size(path, ec);
+}
+
+void Vault::Commit() {
+  stats::Timer timer(stats::PHASE_COMMIT);
+  bool dirty = false;
+  for (auto &opened : shards) {
+    dirty = dirty || (opened && opened->Dirty());
+  }
+  if (!dirty) {
+    return;
+  }
+
+  // Reloading may replace the shards, so look for the dirty ones again.
+  LockExclusive();
+  try {
+    for (auto &opened : shards) {
+      if (opened && opened->Dirty()) {
+        opened->Commit();
+      }
+    }
+    bumpCommits();
+  } catch (...) {
+    Unlock();
+    throw;
+  }
+  Unlock();
+}
+
+void Vault::Compact(size_t count, std::optional<Compression> compression) {
+  stats::Timer timer(stats::PHASE_COMPACT);
+  LockExclusive();
+  try {
+    compact(count, compression);
+    bumpCommits();
+  } catch (...) {
+    Unlock();
+    throw;
+  }
+  Unlock();
+}
+
+// Compact with the lock held.
+void Vault::compact(size_t count, std::optional<Compression> compression) {
+  if (count == 0) {
+    count = shardCount;
+  }
+  if (count > MAX_SHARDS) {
+    throw std::runtime_error("at most " + std::to_string(MAX_SHARDS) +
+                             " shards are supported");
+  }
+  uint32_t id = KeyId();
+  if (!compression) {
+    compression = shard(0).GetCompression();
+  }
+
+  // A single-file vault that stays one is compacted in place.
+  if (count == 1 && !sharded) {
+    Shard &only = shard(0);
+    only.SetKeyId(id);
+    only.SetCompression(*compression);
+    only.Compact();
+    load();
+    return;
+  }
+
+  std::vector<ShardBuilder> builders(count, ShardBuilder(*compression));
+  ForEach([&builders, count](const EntryView &entry) {
+    builders[shardOf(entry.GetName(), count)].Add(entry);
+  });
+
+  // The new files are complete before the vault path is replaced, so a crash
+  // leaves either the old vault or the new one. The logs they replace are
+  // removed afterwards; old generations are never read again.
+  bool wasSharded = sharded;
+  uint64_t oldGeneration = generation;
+  size_t oldCount = shardCount;
+  std::error_code ec;
+  if (count == 1) {
+    fs::remove(logPathOf(path), ec); // stale: a sharded vault has no such log
+    writeFileAtomic(path, builders[0].Finish(id));
+  } else {
+    uint64_t next = generation + 1;
+    for (size_t i = 0; i < count; ++i) {
+      writeFileAtomic(shardPath(next, i), builders[i].Finish(0));
+    }
+
+    VaultManifest manifest{};
+    memcpy(manifest.magic, MANIFEST_MAGIC, 4);
+    manifest.version = MANIFEST_VERSION;
+    manifest.generation = next;
+    manifest.shardCount = count;
+    manifest.keyId = id;
+    writeFileAtomic(path, std::string(reinterpret_cast<const char *>(&manifest),
+                                      sizeof(manifest)));
+    if (!wasSharded) {
+      fs::remove(logPathOf(path), ec);
+      fs::remove(sumPathOf(path), ec);
+    }
+  }
+
+  shards.clear(); // unmap before removing the files
+  if (wasSharded) {
+    removeShards(oldGeneration, oldCount);
+  }
+  load();
+}
+
+bool Vault::CounterChanged() const { return lock.ReadCounter() != commits; }
+
+bool Vault::Changed() const {
+  if (CounterChanged()) {
+    return true;
+  }
+  std::error_code ec;
+  if (fs::last_write_time(path, ec) != manifestTime ||
+      fs::file_size(path, ec) != manifestSize) {
+    return true;
+  }
+  for (auto &opened : shards) {
+    if (opened && opened->Changed()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t Vault::LogRecords() const {
+  size_t records = 0;
+  for (auto &opened : shards) {
+    if (opened) {
+      records += opened->LogRecords();
+    }
+  }
+  return records;
+}
+
+uint32_t Vault::KeyId() const { return newKeyId ? *newKeyId : diskKeyId; }